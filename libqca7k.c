@@ -20,15 +20,128 @@
 */
 
 #include "libqca7k.h"
+#include "libqca7k_frame.h"
 
-static volatile qca7k_state_t _g_state = QCA7K_READING_SOF;
-static volatile uint8_t* _g_recv_buf_origin = NULL, * _g_recv_buf_ptr = NULL;
-/** How many bytes are left to read in current state */
-static volatile size_t _g_state_bytes_left = 4;
-/** What is the byte we are expecting */
-static volatile uint8_t _g_expected_byte = QCA7K_SOF;
-/** Frame length buffer */
-static volatile uint16_t _g_fl = 0;
+#include <string.h>
+
+#if QCA7K_STAGING_SIZE < QCA7K_FRAME_MAX_SIZE + 10
+#error "QCA7K_STAGING_SIZE must fit a framed QCA7K_FRAME_MAX frame"
+#endif
+
+static bool qca7k_recv_start(void* ctx, size_t size);
+static void qca7k_recv_chunk(void* ctx, const uint8_t* data, size_t size);
+static void qca7k_recv_end(void* ctx, qca7k_state_t status);
+static bool qca7k_recv_head(void* ctx, const uint8_t* data, size_t size);
+/** Callbacks putting the frame into the storage of the receive functions */
+static const qca7k_stream_t _g_recv_sink = { qca7k_recv_start, qca7k_recv_chunk, qca7k_recv_end, NULL, NULL };
+/** Same with the receive filter looking at the head first */
+static const qca7k_stream_t _g_recv_filter_sink = { qca7k_recv_start, qca7k_recv_chunk, qca7k_recv_end, NULL, qca7k_recv_head };
+static bool qca7k_rx_accept(const uint8_t* data, size_t size);
+static bool qca7k_rx_dispatch(const uint8_t* data, size_t size);
+
+/** Backlog record overhead */
+#define QCA7K_BACKLOG_HDR 3
+/** Backlog record flag for management frames */
+#define QCA7K_BACKLOG_MGMT 0x01
+
+/** Everything kept per device, all zeroes is the initial state */
+struct qca7k_device
+{
+    /** SPI transfer mode the chip is strapped for */
+    qca7k_spi_mode_t spi_mode;
+    volatile uint8_t* recv_buf_origin, * recv_buf_ptr;
+    /** Receive state machine, set up by qca7k_reset_state_machine */
+    qca7k_decoder_t dec;
+    /** Length of the last fully received frame */
+    volatile size_t recv_len;
+    /** Receive error counters of the staging scan and the timeouts, the decoders keep their own */
+    qca7k_rx_stats_t rx_stats;
+#ifdef QCA7K_HAVE_TIME
+    /** Time a partial frame may wait for more bytes, 0 waits forever */
+    uint32_t recv_timeout;
+    /** Time bytes were last read from the chip */
+    uint32_t recv_last;
+#endif
+    /** Bring-up progress */
+    struct
+    {
+        qca7k_boot_info_t info;
+        /** CPU_ON came since the last reset, the startup is retried until the signature matches */
+        bool cpu_on;
+        /** Startups that failed after CPU_ON */
+        uint8_t attempts;
+#ifdef QCA7K_HAVE_TIME
+        /** Time qca7k_boot_start was called */
+        uint32_t started;
+        /** Time the last reset was issued */
+        uint32_t reset_at;
+        /** Time to wait for CPU_ON before resetting again, 0 waits forever */
+        uint32_t timeout;
+#endif
+    } boot;
+#ifdef QCA7K_HAVE_BUS_LOCK
+    /** Bus lock counters */
+    qca7k_bus_stats_t bus_stats;
+#ifdef QCA7K_HAVE_TIME
+    /** Time the bus lock was taken */
+    uint32_t bus_taken;
+#endif
+#endif
+
+    /** Receive backlog, a ring of records: 2 bytes length (little endian), 1 byte flags, frame */
+    struct
+    {
+        uint8_t buf[QCA7K_BACKLOG_SIZE];
+        /** Offset of the oldest record */
+        size_t head;
+        /** Bytes taken by the records */
+        size_t used;
+        /** Number of records */
+        size_t count;
+        qca7k_drop_policy_t policy;
+        qca7k_backlog_stats_t stats;
+    } backlog;
+    /** Frame storage for the backlog to receive into */
+    uint8_t backlog_frame[QCA7K_FRAME_MAX_SIZE];
+
+    /** Streaming receive state, the callbacks are set on every call */
+    qca7k_decoder_t stream;
+
+    /** Pool frame being received into */
+    qca7k_frame_t* pool_rx;
+
+    /** Receive filter, only looked at if set */
+    qca7k_rx_filter_t filter;
+    bool filtering;
+    qca7k_rx_filter_stats_t filter_stats;
+
+    /** Read staging buffer for the frame views */
+    struct
+    {
+        uint8_t buf[QCA7K_STAGING_SIZE];
+        /** First byte not handed out or skipped */
+        size_t start;
+        /** Bytes read into the buffer */
+        size_t fill;
+        /** Views not released yet */
+        size_t views;
+        /** Bytes left in the chip after the last read */
+        size_t in_chip;
+    } staging;
+};
+
+#ifdef QCA7K_THREADS
+#define QCA7K_THREAD_LOCAL _Thread_local
+#else
+#define QCA7K_THREAD_LOCAL
+#endif
+
+static struct qca7k_device _g_devices[QCA7K_DEVICES];
+/** Device the calls go to, every thread selects its own with QCA7K_THREADS */
+static QCA7K_THREAD_LOCAL struct qca7k_device* _g_dev = &_g_devices[0];
+
+/** Frame buffer pool, shared by all devices */
+static qca7k_frame_t _g_pool[QCA7K_POOL_FRAMES];
 
 /** Repeats the byte to form a symmetric uint16_t */
 static inline uint16_t __u16(uint8_t v)
@@ -36,6 +149,203 @@ static inline uint16_t __u16(uint8_t v)
     return ((uint16_t)v) << 8 | (uint16_t)v;
 }
 
+/** Timestamp to measure a time budget from */
+static inline uint32_t qca7k_budget_start()
+{
+#ifdef QCA7K_HAVE_TIME
+    return qca7k_time_us();
+#else
+    return 0;
+#endif
+}
+
+/** Check if the time budget still has time left */
+static inline bool qca7k_budget_time_left(const qca7k_budget_t* budget, uint32_t start)
+{
+#ifdef QCA7K_HAVE_TIME
+    return !budget->us || (uint32_t)(qca7k_time_us() - start) < budget->us;
+#else
+    (void)budget;
+    (void)start;
+    return true;
+#endif
+}
+
+/** Read a number of bytes from an external read already in progress */
+static inline void qca7k_read_bytes(uint8_t* data, size_t size)
+{
+#if defined(QCA7K_HAVE_SPI_BLOCK)
+    qca7k_spi_read_block(data, size);
+#else
+    size_t i = 0;
+#ifdef QCA7K_HAVE_SPI_WORD16
+    for (; i + 1 < size; i += 2)
+    {
+        uint16_t v = qca7k_spi_read16();
+        data[i] = (uint8_t)(v >> 8);
+        data[i + 1] = (uint8_t)v;
+    }
+#endif
+    for (; i < size; i++)
+        data[i] = qca7k_spi_read();
+#endif
+}
+
+/** Write a number of bytes to an external write already in progress */
+static inline void qca7k_write_bytes(const uint8_t* data, size_t size)
+{
+#if defined(QCA7K_HAVE_SPI_BLOCK)
+    qca7k_spi_write_block(data, size);
+#else
+    size_t i = 0;
+#ifdef QCA7K_HAVE_SPI_WORD16
+    for (; i + 1 < size; i += 2)
+        qca7k_spi_write16(((uint16_t)data[i]) << 8 | data[i + 1]);
+#endif
+    for (; i < size; i++)
+        qca7k_spi_write(data[i]);
+#endif
+}
+
+/** Take the bus for a transaction, other devices on it wait until qca7k_bus_release */
+static inline void qca7k_bus_acquire()
+{
+#ifdef QCA7K_HAVE_BUS_LOCK
+    qca7k_bus_lock();
+#ifdef QCA7K_HAVE_TIME
+    _g_dev->bus_taken = qca7k_time_us();
+#endif
+#endif
+}
+
+/** Give the bus back and account for the time it was held */
+static inline void qca7k_bus_release()
+{
+#ifdef QCA7K_HAVE_BUS_LOCK
+    qca7k_bus_stats_t* stats = &_g_dev->bus_stats;
+    stats->holds++;
+#ifdef QCA7K_HAVE_TIME
+    uint32_t held = qca7k_time_us() - _g_dev->bus_taken;
+    stats->total_us += held;
+    if (held > stats->max_us)
+        stats->max_us = held;
+#endif
+    qca7k_bus_unlock();
+#endif
+}
+
+/** Begin a chip select framed transaction, the bus is only held until qca7k_bus_end */
+static inline void qca7k_bus_begin()
+{
+    qca7k_bus_acquire();
+    qca7k_spi_begin();
+}
+
+/** End a transaction started with qca7k_bus_begin */
+static inline void qca7k_bus_end()
+{
+    qca7k_spi_end();
+    qca7k_bus_release();
+}
+
+/** Legacy mode needs chip select toggled between the command and the data */
+static inline void qca7k_command_gap()
+{
+    if (_g_dev->spi_mode == QCA7K_SPI_LEGACY)
+    {
+        qca7k_spi_end();
+        qca7k_spi_begin();
+    }
+}
+
+#ifdef QCA7K_HAVE_SPI_CLOCK
+/** Check the link at the current clock
+ * @return      number of failed checks
+ */
+static uint32_t qca7k_clock_check(size_t rounds)
+{
+    /* Alternating and solid patterns over the known interrupt bits */
+    static const uint16_t patterns[] = { 0x0047, 0x0000, 0x0045, 0x0002, 0x0041, 0x0006 };
+    uint32_t errors = 0;
+    for (size_t i = 0; i < rounds; i++)
+    {
+        if (qca7k_signature() != QCA7K_SIGNATURE)
+            errors++;
+
+        uint16_t pattern = patterns[i % (sizeof(patterns) / sizeof(patterns[0]))];
+        qca7k_interrupts_set(pattern);
+        if (qca7k_interrupts_get() != pattern)
+            errors++;
+    }
+    return errors;
+}
+
+qca7k_state_t qca7k_clock_calibrate(const uint32_t* rates, size_t count, size_t rounds, size_t margin, qca7k_clock_cal_t* res)
+{
+    qca7k_clock_cal_t cal = { 0 };
+    /* Without rounds every rate would pass unchecked */
+    if (!rates || !count || !rounds)
+        return QCA7K_INVALID_ARGUMENT;
+
+    /* The mask has to be read at a rate known to work */
+    qca7k_spi_clock(rates[0]);
+    uint16_t mask = qca7k_interrupts_get();
+
+    /* Stop at the first rate with errors, the faster ones are not getting any better */
+    size_t good = 0;
+    for (; good < count; good++)
+    {
+        qca7k_spi_clock(rates[good]);
+        uint32_t errors = qca7k_clock_check(rounds);
+        cal.errors += errors;
+        if (errors)
+            break;
+        cal.max_hz = rates[good];
+    }
+
+    size_t chosen = good > margin ? good - 1 - margin : 0;
+    qca7k_spi_clock(rates[chosen]);
+    cal.hz = rates[chosen];
+    qca7k_interrupts_set(mask);
+
+    if (res)
+        *res = cal;
+    return good ? QCA7K_OK : QCA7K_BAD_SIGNATURE;
+}
+#endif
+
+qca7k_state_t qca7k_select(uint8_t dev)
+{
+    if (dev >= QCA7K_DEVICES)
+        return QCA7K_NO_DEVICE;
+
+    _g_dev = &_g_devices[dev];
+    return QCA7K_OK;
+}
+
+uint8_t qca7k_selected()
+{
+    return (uint8_t)(_g_dev - _g_devices);
+}
+
+#ifdef QCA7K_HAVE_BUS_LOCK
+void qca7k_bus_stats(qca7k_bus_stats_t* stats)
+{
+    if (stats)
+        *stats = _g_dev->bus_stats;
+}
+
+void qca7k_bus_stats_clear()
+{
+    memset(&_g_dev->bus_stats, 0, sizeof(_g_dev->bus_stats));
+}
+#endif
+
+void qca7k_spi_mode(qca7k_spi_mode_t mode)
+{
+    _g_dev->spi_mode = mode;
+}
+
 void qca7k_interrupts_enable_all()
 {
     qca7k_interrupts_set(QCA7K_INT_CPU_ON | QCA7K_INT_WRBUF_ERR | QCA7K_INT_RDBUF_ERR | QCA7K_INT_PKT_AVLBL);
@@ -58,28 +368,36 @@ void qca7k_interrupts_disable(uint16_t mask)
 
 uint16_t qca7k_interrupt_reasons()
 {
-    qca7k_interrupts_disable_all();
+    return qca7k_interrupt_status(NULL, NULL);
+}
 
-    qca7k_spi_begin();
-    qca7k_write_command(true, true, QCA7K_REG_INTR_CAUSE);
-    uint16_t reasons = qca7k_read_register();
-    qca7k_spi_end();
+uint16_t qca7k_interrupt_status(uint16_t* read_available, uint16_t* write_space)
+{
+    qca7k_txn_t txn;
+    qca7k_txn_init(&txn);
 
-    /* Confirming by rewriting the same value */
-    qca7k_spi_begin();
-    qca7k_write_command(false, true, QCA7K_REG_INTR_CAUSE);
-    qca7k_write_register(reasons);
-    qca7k_spi_end();
+    uint16_t reasons = 0;
+    qca7k_txn_write(&txn, QCA7K_REG_INTR_ENABLE, 0x0000);
+    qca7k_txn_read(&txn, QCA7K_REG_INTR_CAUSE, &reasons);
+    if (read_available)
+        qca7k_txn_read(&txn, QCA7K_REG_RDBUF_BYTE_AVA, read_available);
+    if (write_space)
+        qca7k_txn_read(&txn, QCA7K_REG_WRBUF_SPC_AVA, write_space);
+    qca7k_txn_submit(&txn);
+
+    /* Confirming by rewriting the same value, needs the value so goes separately */
+    qca7k_txn_write(&txn, QCA7K_REG_INTR_CAUSE, reasons);
+    qca7k_txn_submit(&txn);
 
     return reasons;
 }
 
 uint16_t qca7k_signature()
 {
-    qca7k_spi_begin();
+    qca7k_bus_begin();
     qca7k_write_command(true, true, QCA7K_REG_SIGNATURE);
     uint16_t res = qca7k_read_register();
-    qca7k_spi_end();
+    qca7k_bus_end();
 
     return res;
 }
@@ -99,15 +417,57 @@ qca7k_state_t qca7k_startup()
 void qca7k_reset()
 {
     /* Reset is the only known bit of the config register, so no point in making a wider API */
-    qca7k_spi_begin();
+    qca7k_bus_begin();
     qca7k_write_command(true, true, QCA7K_REG_SPI_CONFIG);
     uint16_t config = qca7k_read_register();
-    qca7k_spi_end();
+    qca7k_bus_end();
 
-    qca7k_spi_begin();
+    qca7k_bus_begin();
     qca7k_write_command(false, true, QCA7K_REG_SPI_CONFIG);
     qca7k_write_register(config | QCA7K_SLAVE_RESET_BIT);
-    qca7k_spi_end();
+    qca7k_bus_end();
+}
+
+/** Get the write buffer space available */
+static inline uint16_t qca7k_write_space()
+{
+    qca7k_bus_begin();
+    qca7k_write_command(true, true, QCA7K_REG_WRBUF_SPC_AVA);
+    uint16_t res = qca7k_read_register();
+    qca7k_bus_end();
+
+    return res;
+}
+
+/** Inform the size of the external write operation */
+static inline void qca7k_write_buffer_size(size_t size)
+{
+    qca7k_bus_begin();
+    qca7k_write_command(false, true, QCA7K_REG_BFR_SIZE);
+    qca7k_write_register((uint16_t)size);
+    qca7k_bus_end();
+}
+
+/** Write a framed frame as an external write, the size has to be announced already
+ * @param data          data to transmit
+ * @param size          length of data
+ */
+static void qca7k_write_frame(const uint8_t* data, size_t size)
+{
+    /* Write actual data as external write */
+    qca7k_bus_begin();
+    qca7k_write_command(false, false, 0x0000);
+
+    /* Start of Frame, frame length and reserved */
+    uint8_t header[8];
+    qca7k_encode_header(header, size);
+    qca7k_write_bytes(header, sizeof(header));
+
+    /* Frame data, then padding and End of Frame */
+    uint8_t trailer[QCA7K_FRAME_MIN_SIZE + 2];
+    qca7k_write_bytes(data, size);
+    qca7k_write_bytes(trailer, qca7k_encode_trailer(trailer, size));
+    qca7k_bus_end();
 }
 
 qca7k_state_t qca7k_send(uint8_t* data, size_t size)
@@ -121,237 +481,1310 @@ qca7k_state_t qca7k_send(uint8_t* data, size_t size)
 
     /* Calculate the size needs and compare with available space */
     size_t size_needed = 4 + 2 + 2 + size_to_write + 2;
-    qca7k_spi_begin();
-    qca7k_write_command(true, true, QCA7K_REG_WRBUF_SPC_AVA);
-    uint16_t write_available = qca7k_read_register();
-    qca7k_spi_end();
-
-    if (write_available < size_needed)
+    if (qca7k_write_space() < size_needed)
         return QCA7K_WRITE_BUFFER_INSUFFICIENT;
 
-    /* Inform the size of the external write operation */
-    qca7k_spi_begin();
-    qca7k_write_command(false, true, QCA7K_REG_BFR_SIZE);
-    qca7k_write_register((uint16_t)size_needed);
-    qca7k_spi_end();
+    qca7k_write_buffer_size(size_needed);
+    qca7k_write_frame(data, size);
 
-    /* Write actual data as external write */
-    qca7k_spi_begin();
-    qca7k_write_command(false, false, 0x0000);
+    return QCA7K_OK;
+}
 
-    /* Start of Frame (double) */
-    qca7k_write_register(__u16(QCA7K_SOF));
-    qca7k_write_register(__u16(QCA7K_SOF));
+/** Send frames while there is space and budget
+ * @param budget    budget, NULL for none
+ * @return          number of descriptors handled
+ */
+static size_t qca7k_send_msgs(qca7k_msg_t* msgs, size_t count, qca7k_budget_t* budget)
+{
+    if (!msgs)
+        return 0;
 
-    /* Frame length
-     * NOTE: Little endian! */
-    union
+    /* Space is checked once for the whole batch and then spent frame by frame */
+    uint32_t start = qca7k_budget_start();
+    size_t space = qca7k_write_space();
+    size_t spent = 0;
+    size_t i = 0;
+    for (; i < count; i++)
     {
-        uint16_t val;
-        uint8_t bytes[2];
-    } res;
-    res.val = size_to_write;
-#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
-    uint16_t t = res.bytes[0];
-    res.bytes[0] = res.bytes[1];
-    res.bytes[1] = t;
-#endif
+        qca7k_msg_t* msg = &msgs[i];
+        if (!msg->data)
+        {
+            msg->status = QCA7K_INVALID_ARGUMENT;
+            continue;
+        }
+        if (msg->size > QCA7K_FRAME_MAX)
+        {
+            msg->status = QCA7K_FRAME_OVERFLOW;
+            continue;
+        }
 
-    /* Reserved */
-    qca7k_write_register(__u16(QCA7K_RESERVED));
+        size_t size_to_write = msg->size < QCA7K_FRAME_MIN ? QCA7K_FRAME_MIN : msg->size;
+        size_t size_needed = 4 + 2 + 2 + size_to_write + 2;
+        if (space < size_needed)
+        {
+            msg->status = QCA7K_WRITE_BUFFER_INSUFFICIENT;
+            break;
+        }
 
-    /* Frame data */
-    for (size_t i = 0; i < size_to_write; i++)
-        qca7k_spi_write(i < size ? data[i] : 0x00);
+        /* Frames are the boundary to stop at, but the first one always goes or nothing would ever move */
+        if (budget && spent && ((budget->bytes && spent + size_needed > budget->bytes) || !qca7k_budget_time_left(budget, start)))
+            break;
 
-    /* End of frame */
-    qca7k_write_register(__u16(QCA7K_EOF));
-    qca7k_spi_end();
+        space -= size_needed;
+        spent += size_needed;
 
-    return QCA7K_OK;
+        qca7k_write_buffer_size(size_needed);
+        qca7k_write_frame(msg->data, msg->size);
+        msg->status = QCA7K_OK;
+    }
+
+    if (budget)
+    {
+        budget->spent = spent;
+        budget->pending = 0;
+        for (size_t j = i; j < count; j++)
+            budget->pending += msgs[j].data ? QCA7K_TX_BUFFER_SIZE(msgs[j].size) - 2 : 0;
+    }
+    return i;
 }
 
-/** Set the state back to the "waiting for SOF" state */
-static inline void qca7k_reset_state_machine(volatile uint8_t * data)
+size_t qca7k_send_batch(qca7k_msg_t* msgs, size_t count)
 {
-    _g_recv_buf_origin = data;
-    _g_recv_buf_ptr = data;
-    _g_state_bytes_left = 4;
-    _g_expected_byte = QCA7K_SOF;
-    _g_state = QCA7K_READING_SOF;
-    _g_fl = 0;
+    return qca7k_send_msgs(msgs, count, NULL);
 }
 
-qca7k_state_t qca7k_recv(uint8_t* data)
+size_t qca7k_send_budget(qca7k_msg_t* msgs, size_t count, qca7k_budget_t* budget)
 {
-    /* Check for NULL not to confuse our logic */
-    if (!data)
-        return QCA7K_NULL_RECV_BUFFER;
-
-    /* Fix the state if the last one was the end of the frame or internal error
-     * Check that buffer pointer is the same or uninialized */
-    if (!_g_recv_buf_origin || data != _g_recv_buf_origin || _g_state == QCA7K_OK || _g_state == QCA7K_INTERNAL_ERROR)
-        qca7k_reset_state_machine(data);
+    return qca7k_send_msgs(msgs, count, budget);
+}
 
-    /* Check how many bytes are available for reading */
-    qca7k_spi_begin();
-    qca7k_write_command(true, true, QCA7K_REG_RDBUF_BYTE_AVA);
-    uint16_t bytes_available = qca7k_read_register();
-    qca7k_spi_end();
-    if (!bytes_available)
-        return QCA7K_EMPTY_READ_BUFFER;
+qca7k_state_t qca7k_send_inplace(uint8_t* buf, size_t size)
+{
+    if (!buf)
+        return QCA7K_INVALID_ARGUMENT;
+    if (size > QCA7K_FRAME_MAX)
+        return QCA7K_FRAME_OVERFLOW;
 
-    /* Scan the read buffer */
-    qca7k_spi_begin();
-    qca7k_write_command(true, false, 0x0000);
-    bool retry_loop = false;
-    for (size_t i = 0; i < bytes_available; i++)
-    {
-        /* Read a byte if we're not in retry mode */
-        static uint8_t v = 0x00;
-        if (!retry_loop)
-            v = qca7k_spi_read();
-        else 
-            retry_loop = false;
-
-        /* We assume this is never run twice in parallel so we can expect that we are in control of all the globals */
-        switch (_g_state)
-        {
-            /* In 3 modes we are waiting for the same characters to pop up and just counting */
-            case QCA7K_READING_SOF:
-            case QCA7K_READING_RESERVED:
-            case QCA7K_READING_EOF:
-                if (_g_expected_byte != v)
-                {
-                    qca7k_reset_state_machine(_g_recv_buf_origin);
-                    /* Re-trying the same character if it wasn't SOF mode */
-                    if (_g_state != QCA7K_READING_SOF)
-                    {
-                        retry_loop = true;
-                        i --;
-                    }
-                    continue;
-                }
-                break;
+    size_t size_to_write = size < QCA7K_FRAME_MIN ? QCA7K_FRAME_MIN : size;
+    size_t size_needed = 4 + 2 + 2 + size_to_write + 2;
+    if (qca7k_write_space() < size_needed)
+        return QCA7K_WRITE_BUFFER_INSUFFICIENT;
 
-            /* In FL mode, compose the value
-            * NOTE: Little Endian */
-            case QCA7K_READING_FL:
-                _g_fl <<= 8;
-                _g_fl |= v;
-                break;
+    qca7k_write_buffer_size(size_needed);
 
-            /* In frame reading mode just save data */
-            case QCA7K_READING_FRAME:
-                *_g_recv_buf_ptr ++ = v;
-                break;
+    /* External write command (all zeroes) and the header go into the headroom */
+    buf[0] = buf[1] = 0x00;
+    qca7k_encode_header(buf + 2, size);
 
-            /* This should never happen, but if it does, let's try to clean up everything */
-            default:
-                qca7k_reset_state_machine(NULL);
-                _g_state = QCA7K_INTERNAL_ERROR;
-                goto done;
-        }
+    /* Padding and End of Frame go after the frame */
+    qca7k_encode_trailer(buf + QCA7K_TX_HEADROOM + size, size);
 
-        /* If we made this far, the byte was accepted, check if we are at the end of the stage */
-        _g_state_bytes_left --;
-        if (!_g_state_bytes_left)
-        {
-            switch (_g_state)
-            {
-                case QCA7K_READING_SOF:
-                    _g_state = QCA7K_READING_FL;
-                    _g_state_bytes_left = 2;
-                    break;
-
-                case QCA7K_READING_FL:
-                    _g_state = QCA7K_READING_RESERVED;
-                    _g_state_bytes_left = 2;
-                    _g_expected_byte = QCA7K_RESERVED;
-                    break;
-
-                case QCA7K_READING_RESERVED:
-                    _g_state = QCA7K_READING_FRAME;
-                    _g_recv_buf_ptr = _g_recv_buf_origin;
-                    _g_state_bytes_left = _g_fl;
-                    break;
-
-                case QCA7K_READING_FRAME:
-                    _g_state = QCA7K_READING_EOF;
-                    _g_state_bytes_left = 2;
-                    _g_expected_byte = QCA7K_EOF;
-                    break;
-
-                /* TODO: what happens if we don't read the full buffer? */
-                case QCA7K_READING_EOF:
-                    qca7k_reset_state_machine(_g_recv_buf_origin);
-                    _g_state = QCA7K_OK;
-                    goto done;
-                    break;
-
-                /* Will not happen but let's keep the compiler happy */
-                default:
-                    break;
-            }
-        }
+    qca7k_bus_begin();
+    if (_g_dev->spi_mode == QCA7K_SPI_LEGACY)
+    {
+        qca7k_write_bytes(buf, 2);
+        qca7k_command_gap();
+        qca7k_write_bytes(buf + 2, QCA7K_TX_BUFFER_SIZE(size) - 2);
     }
+    else
+        qca7k_write_bytes(buf, QCA7K_TX_BUFFER_SIZE(size));
+    qca7k_bus_end();
 
-done:
-    qca7k_spi_end();
+    return QCA7K_OK;
+}
 
-    return _g_state;
+/** Set the state back to the "waiting for SOF" state */
+static inline void qca7k_reset_state_machine(volatile uint8_t * data)
+{
+    _g_dev->recv_buf_origin = data;
+    _g_dev->recv_buf_ptr = data;
+    _g_dev->dec.stream = _g_dev->filtering ? &_g_recv_filter_sink : &_g_recv_sink;
+    qca7k_decoder_reset(&_g_dev->dec);
 }
 
-void qca7k_write_command(bool rw, bool in, uint16_t reg)
+/** Frame data goes to the beginning of the storage */
+static bool qca7k_recv_start(void* ctx, size_t size)
 {
-    uint16_t res = in ? ( (reg << 2) >> 2 ) : 0x0000;
-    res |= ((uint16_t) rw) << 15 | ((uint16_t) in) << 14;
-    qca7k_write_register(res);
+    (void)ctx;
+    (void)size;
+    _g_dev->recv_buf_ptr = _g_dev->recv_buf_origin;
+    return true;
 }
 
-void qca7k_write_register(uint16_t val)
+static void qca7k_recv_chunk(void* ctx, const uint8_t* data, size_t size)
 {
-    union
+    (void)ctx;
+    memcpy((uint8_t*)_g_dev->recv_buf_ptr, data, size);
+    _g_dev->recv_buf_ptr += size;
+}
+
+static bool qca7k_recv_head(void* ctx, const uint8_t* data, size_t size)
+{
+    (void)ctx;
+    return qca7k_rx_accept(data, size);
+}
+
+static void qca7k_recv_end(void* ctx, qca7k_state_t status)
+{
+    (void)ctx;
+    if (status == QCA7K_OK)
+        _g_dev->recv_len = _g_dev->recv_buf_ptr - _g_dev->recv_buf_origin;
+}
+
+/** Run staged bytes through the state machine until a frame is complete or they run out
+ * Frames the filter drops or a handler takes are gone past without stopping
+ * @return  state after the last byte, QCA7K_EMPTY_READ_BUFFER if the bytes ran out right after such a frame
+ */
+static inline qca7k_state_t qca7k_recv_parse()
+{
+    for (;;)
     {
-        uint16_t val;
-        uint8_t bytes[2];
-    } res;
-    res.val = val;
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-    uint16_t t = res.bytes[0];
-    res.bytes[0] = res.bytes[1];
-    res.bytes[1] = t;
+        _g_dev->staging.start += qca7k_decoder_feed(&_g_dev->dec, _g_dev->staging.buf + _g_dev->staging.start, _g_dev->staging.fill - _g_dev->staging.start);
+        if (_g_dev->dec.state != QCA7K_OK)
+            return _g_dev->dec.state;
+        if (!_g_dev->dec.skip && !qca7k_rx_dispatch((const uint8_t*)_g_dev->recv_buf_origin, _g_dev->recv_len))
+            return QCA7K_OK;
+        if (_g_dev->staging.start == _g_dev->staging.fill)
+            return QCA7K_EMPTY_READ_BUFFER;
+    }
+}
+
+/** Check how many bytes are available for reading */
+static inline uint16_t qca7k_read_available()
+{
+    qca7k_bus_begin();
+    qca7k_write_command(true, true, QCA7K_REG_RDBUF_BYTE_AVA);
+    uint16_t res = qca7k_read_register();
+    qca7k_bus_end();
+
+    return res;
+}
+
+/** Check if part of a frame has been received, by the state machine or into the staging buffer */
+static inline bool qca7k_recv_partial()
+{
+    return _g_dev->staging.start != _g_dev->staging.fill || qca7k_decoder_partial(&_g_dev->dec);
+}
+
+/** Note that the chip delivered bytes, for the receive timeout */
+static inline void qca7k_recv_activity()
+{
+#ifdef QCA7K_HAVE_TIME
+    if (_g_dev->recv_timeout)
+        _g_dev->recv_last = qca7k_time_us();
 #endif
-    qca7k_spi_write(res.bytes[0]);
-    qca7k_spi_write(res.bytes[1]);
 }
 
-uint16_t qca7k_read_register()
+/** Check if the chip has not delivered anything for longer than the receive timeout */
+static inline bool qca7k_recv_stalled()
 {
-    uint16_t res = (uint16_t)qca7k_spi_read();
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-    res |= ((uint16_t)qca7k_spi_read()) << 8;
+#ifdef QCA7K_HAVE_TIME
+    return _g_dev->recv_timeout && (uint32_t)(qca7k_time_us() - _g_dev->recv_last) >= _g_dev->recv_timeout;
 #else
-    res <<= 8;
-    res |= (uint16_t)qca7k_spi_read();
+    return false;
 #endif
-    return res;
 }
 
-uint16_t qca7k_interrupts_get()
+/** Discard a partial frame if the chip has not delivered anything for longer than the timeout */
+static void qca7k_recv_expire()
 {
-    qca7k_spi_begin();
-    qca7k_write_command(true, true, QCA7K_REG_INTR_ENABLE);
-    uint16_t res= qca7k_read_register();
-    qca7k_spi_end();
+    if (!qca7k_recv_partial() || !qca7k_recv_stalled())
+        return;
 
-    return res;
+    _g_dev->rx_stats.timeouts++;
+    qca7k_reset_state_machine(_g_dev->recv_buf_origin);
+    _g_dev->staging.start = _g_dev->staging.fill;
 }
 
-void qca7k_interrupts_set(uint16_t mask)
+void qca7k_recv_resync()
 {
-    qca7k_spi_begin();
-    qca7k_write_command(false, true, QCA7K_REG_INTR_ENABLE);
-    qca7k_write_register(mask);
-    qca7k_spi_end();
+    qca7k_reset_state_machine(_g_dev->recv_buf_origin);
+    qca7k_decoder_reset(&_g_dev->stream);
+    _g_dev->staging.start = _g_dev->staging.fill;
+    _g_dev->staging.in_chip = 0;
+}
+
+/** Make room in the staging buffer and announce a read of what the chip has with BFR_SIZE
+ * The bytes not consumed yet are kept, moved to the beginning
+ * @param limit maximum number of bytes to read
+ * @return      number of bytes to read
+ */
+static size_t qca7k_staging_prepare(size_t limit)
+{
+    memmove(_g_dev->staging.buf, _g_dev->staging.buf + _g_dev->staging.start, _g_dev->staging.fill - _g_dev->staging.start);
+    _g_dev->staging.fill -= _g_dev->staging.start;
+    _g_dev->staging.start = 0;
+
+    size_t bytes_available = qca7k_read_available();
+    _g_dev->staging.in_chip = bytes_available;
+    if (bytes_available > QCA7K_STAGING_SIZE - _g_dev->staging.fill)
+        bytes_available = QCA7K_STAGING_SIZE - _g_dev->staging.fill;
+    if (bytes_available > limit)
+        bytes_available = limit;
+    if (!bytes_available)
+    {
+        qca7k_recv_expire();
+        return 0;
+    }
+
+    qca7k_write_buffer_size(bytes_available);
+    return bytes_available;
+}
+
+/** Read what the chip has into the staging buffer, keeping the bytes not consumed yet
+ * The size is announced with BFR_SIZE first, so the chip streams the whole read buffer in one go
+ * @param limit maximum number of bytes to read
+ * @return      number of bytes read
+ */
+static size_t qca7k_staging_refill(size_t limit)
+{
+    size_t bytes_available = qca7k_staging_prepare(limit);
+    if (!bytes_available)
+        return 0;
+
+    qca7k_bus_begin();
+    qca7k_write_command(true, false, 0x0000);
+    qca7k_read_bytes(_g_dev->staging.buf + _g_dev->staging.fill, bytes_available);
+    qca7k_bus_end();
+    _g_dev->staging.fill += bytes_available;
+    _g_dev->staging.in_chip -= bytes_available;
+    qca7k_recv_activity();
+
+    return bytes_available;
+}
+
+#ifdef QCA7K_HAVE_SPI_ASYNC
+/** Refill the staging buffer and run it through the state machine at the same time
+ * The read is split in chunks, the next one is on the wire while the previous one is parsed.
+ * Once a frame is complete the rest of the read goes in one chunk and stays staged for the next call.
+ * @param res   state after the last byte parsed before
+ * @return      state after the last byte, res if there was nothing to read
+ */
+static qca7k_state_t qca7k_recv_pipelined(qca7k_state_t res)
+{
+    size_t total = qca7k_staging_prepare(SIZE_MAX);
+    if (!total)
+        return res;
+
+    bool done = false;
+
+    qca7k_bus_begin();
+    qca7k_write_command(true, false, 0x0000);
+    size_t left = total, pending = left < QCA7K_PIPELINE_CHUNK ? left : QCA7K_PIPELINE_CHUNK;
+    qca7k_spi_read_start(_g_dev->staging.buf + _g_dev->staging.fill, pending);
+    while (pending)
+    {
+        qca7k_spi_read_wait();
+        _g_dev->staging.fill += pending;
+        left -= pending;
+
+        /* Next chunk lands past the fill mark, the parser stays below it */
+        pending = done || left < QCA7K_PIPELINE_CHUNK ? left : QCA7K_PIPELINE_CHUNK;
+        if (pending)
+            qca7k_spi_read_start(_g_dev->staging.buf + _g_dev->staging.fill, pending);
+
+        if (!done && _g_dev->staging.start < _g_dev->staging.fill)
+        {
+            res = qca7k_recv_parse();
+            done = res == QCA7K_OK;
+        }
+    }
+    qca7k_bus_end();
+    _g_dev->staging.in_chip -= total;
+    qca7k_recv_activity();
+
+    return res;
+}
+#endif
+
+/** Run staged bytes through the state machine until a frame is complete, staging more once if they run out
+ * @param refilled  whether the staging buffer was refilled already, updated
+ * @return          state after the last byte, QCA7K_EMPTY_READ_BUFFER if there was nothing to read
+ */
+static qca7k_state_t qca7k_recv_staged(bool* refilled)
+{
+    qca7k_state_t res = QCA7K_EMPTY_READ_BUFFER;
+    for (;;)
+    {
+        if (_g_dev->staging.start == _g_dev->staging.fill)
+        {
+            if (*refilled)
+                return res;
+            *refilled = true;
+#ifdef QCA7K_HAVE_SPI_ASYNC
+            return qca7k_recv_pipelined(res);
+#else
+            if (!qca7k_staging_refill(SIZE_MAX))
+                return res;
+#endif
+        }
+
+        res = qca7k_recv_parse();
+        if (res == QCA7K_OK)
+            return res;
+    }
+}
+
+/** Receive into the given storage, a partial frame only continues if it is the same as before
+ * @param data  storage for the frame
+ */
+static void qca7k_recv_bind(uint8_t* data)
+{
+    /* Fix the state if the last one was the end of the frame
+     * Check that buffer pointer is the same or uninialized */
+    if (!_g_dev->recv_buf_origin || data != _g_dev->recv_buf_origin || _g_dev->dec.state == QCA7K_OK)
+    {
+        /* The old storage may be gone already, so a frame in progress is dropped rather than copied */
+        if (_g_dev->recv_buf_origin && qca7k_decoder_partial(&_g_dev->dec))
+            _g_dev->rx_stats.abandoned++;
+        qca7k_reset_state_machine(data);
+    }
+}
+
+qca7k_state_t qca7k_recv(uint8_t* data)
+{
+    /* Check for NULL not to confuse our logic */
+    if (!data)
+        return QCA7K_NULL_RECV_BUFFER;
+
+    qca7k_recv_bind(data);
+
+    /* The whole read buffer is staged at once, whatever follows this frame waits for the next call */
+    bool refilled = false;
+    return qca7k_recv_staged(&refilled);
+}
+
+qca7k_state_t qca7k_recv_budget(uint8_t* data, qca7k_budget_t* budget)
+{
+    if (!data)
+        return QCA7K_NULL_RECV_BUFFER;
+    if (!budget)
+        return qca7k_recv(data);
+
+    qca7k_recv_bind(data);
+
+    /* Reads go in chunks so the budget can be checked in between, the state machine resumes at any byte */
+    uint32_t start = qca7k_budget_start();
+    size_t spent = 0;
+    qca7k_state_t res = QCA7K_EMPTY_READ_BUFFER;
+    for (;;)
+    {
+        if (_g_dev->staging.start == _g_dev->staging.fill)
+        {
+            if ((budget->bytes && spent >= budget->bytes) || !qca7k_budget_time_left(budget, start))
+                break;
+
+            size_t limit = budget->us ? QCA7K_BUDGET_CHUNK : SIZE_MAX;
+            if (budget->bytes && budget->bytes - spent < limit)
+                limit = budget->bytes - spent;
+            size_t n = qca7k_staging_refill(limit);
+            if (!n)
+                break;
+            spent += n;
+        }
+
+        res = qca7k_recv_parse();
+        if (res == QCA7K_OK)
+            break;
+    }
+
+    budget->pending = _g_dev->staging.in_chip + _g_dev->staging.fill - _g_dev->staging.start;
+    budget->spent = spent;
+    return res;
+}
+
+#ifdef QCA7K_HAVE_TIME
+void qca7k_recv_timeout(uint32_t us)
+{
+    _g_dev->recv_timeout = us;
+    _g_dev->recv_last = qca7k_time_us();
+}
+#endif
+
+void qca7k_rx_stats(qca7k_rx_stats_t* stats)
+{
+    if (!stats)
+        return;
+
+    const qca7k_decoder_t* decs[] = { &_g_dev->dec, &_g_dev->stream };
+    *stats = _g_dev->rx_stats;
+    for (size_t i = 0; i < sizeof(decs) / sizeof(decs[0]); i++)
+    {
+        stats->bad_length += decs[i]->stats.bad_length;
+        stats->bad_framing += decs[i]->stats.bad_framing;
+    }
+}
+
+/** Reset the selected device and wait for CPU_ON again */
+static void qca7k_boot_reset()
+{
+    qca7k_recv_resync();
+    qca7k_reset();
+    _g_dev->boot.info.resets++;
+    _g_dev->boot.info.state = QCA7K_BOOT_WAITING;
+    _g_dev->boot.cpu_on = false;
+    _g_dev->boot.attempts = 0;
+#ifdef QCA7K_HAVE_TIME
+    _g_dev->boot.reset_at = qca7k_time_us();
+#endif
+}
+
+void qca7k_boot_start()
+{
+    _g_dev->boot.info.resets = 0;
+    _g_dev->boot.info.latency_us = 0;
+#ifdef QCA7K_HAVE_TIME
+    _g_dev->boot.started = qca7k_time_us();
+#endif
+    qca7k_boot_reset();
+}
+
+void qca7k_boot_start_all()
+{
+    struct qca7k_device* selected = _g_dev;
+    for (size_t i = 0; i < QCA7K_DEVICES; i++)
+    {
+        _g_dev = &_g_devices[i];
+        qca7k_boot_start();
+    }
+    _g_dev = selected;
+}
+
+/** Reset again, give up after QCA7K_BOOT_RESETS resets */
+static void qca7k_boot_retry()
+{
+    if (_g_dev->boot.info.resets >= QCA7K_BOOT_RESETS)
+        _g_dev->boot.info.state = QCA7K_BOOT_FAILED;
+    else
+        qca7k_boot_reset();
+}
+
+/** Reset again if CPU_ON is overdue */
+static void qca7k_boot_check_timeout()
+{
+#ifdef QCA7K_HAVE_TIME
+    if (_g_dev->boot.timeout && (uint32_t)(qca7k_time_us() - _g_dev->boot.reset_at) >= _g_dev->boot.timeout)
+        qca7k_boot_retry();
+#endif
+}
+
+qca7k_boot_state_t qca7k_boot_event(uint16_t reasons)
+{
+    if (_g_dev->boot.info.state != QCA7K_BOOT_WAITING)
+        return _g_dev->boot.info.state;
+
+    /* CPU_ON comes once per boot, so the startup is retried on every call after it */
+    if (reasons & QCA7K_INT_CPU_ON)
+        _g_dev->boot.cpu_on = true;
+    if (!_g_dev->boot.cpu_on)
+    {
+        qca7k_boot_check_timeout();
+        return _g_dev->boot.info.state;
+    }
+
+    /* A bad signature right after CPU_ON is a chip still coming up, it gets QCA7K_BOOT_ATTEMPTS tries */
+    if (qca7k_startup() != QCA7K_OK)
+    {
+        if (++_g_dev->boot.attempts >= QCA7K_BOOT_ATTEMPTS)
+            qca7k_boot_retry();
+        else
+            qca7k_boot_check_timeout();
+        return _g_dev->boot.info.state;
+    }
+
+    _g_dev->boot.info.state = QCA7K_BOOT_READY;
+#ifdef QCA7K_HAVE_TIME
+    _g_dev->boot.info.latency_us = qca7k_time_us() - _g_dev->boot.started;
+#endif
+    return QCA7K_BOOT_READY;
+}
+
+qca7k_boot_state_t qca7k_boot_poll()
+{
+    if (_g_dev->boot.info.state != QCA7K_BOOT_WAITING)
+        return _g_dev->boot.info.state;
+
+    qca7k_txn_t txn;
+    qca7k_txn_init(&txn);
+    uint16_t reasons = 0;
+    qca7k_txn_read(&txn, QCA7K_REG_INTR_CAUSE, &reasons);
+    qca7k_txn_submit(&txn);
+
+    /* Confirmed only when there is something, the cause register is read alone most of the time */
+    if (reasons & QCA7K_INT_CPU_ON)
+    {
+        qca7k_txn_write(&txn, QCA7K_REG_INTR_CAUSE, reasons);
+        qca7k_txn_submit(&txn);
+    }
+    return qca7k_boot_event(reasons);
+}
+
+size_t qca7k_boot_poll_all()
+{
+    struct qca7k_device* selected = _g_dev;
+    size_t ready = 0;
+    for (size_t i = 0; i < QCA7K_DEVICES; i++)
+    {
+        _g_dev = &_g_devices[i];
+        if (qca7k_boot_poll() == QCA7K_BOOT_READY)
+            ready++;
+    }
+    _g_dev = selected;
+    return ready;
+}
+
+#ifdef QCA7K_HAVE_TIME
+void qca7k_boot_timeout(uint32_t us)
+{
+    _g_dev->boot.timeout = us;
+}
+#endif
+
+void qca7k_boot_info(qca7k_boot_info_t* info)
+{
+    if (info)
+        *info = _g_dev->boot.info;
+}
+
+size_t qca7k_recv_flush()
+{
+    qca7k_recv_resync();
+
+    /* Only what is there now, a busy link would keep it going forever otherwise */
+    uint8_t chunk[QCA7K_STREAM_CHUNK];
+    size_t bytes_available = qca7k_read_available(), dropped = 0;
+    while (dropped < bytes_available)
+    {
+        size_t n = bytes_available - dropped < sizeof(chunk) ? bytes_available - dropped : sizeof(chunk);
+        qca7k_write_buffer_size(n);
+
+        qca7k_bus_begin();
+        qca7k_write_command(true, false, 0x0000);
+        qca7k_read_bytes(chunk, n);
+        qca7k_bus_end();
+        dropped += n;
+    }
+
+    return dropped;
+}
+
+size_t qca7k_recv_batch(qca7k_msg_t* msgs, size_t count)
+{
+    if (!msgs || !count)
+        return 0;
+    if (!msgs[0].data)
+    {
+        msgs[0].status = QCA7K_NULL_RECV_BUFFER;
+        return 0;
+    }
+
+    /* A frame left incomplete by the previous call continues in the first descriptor if it is the same storage */
+    qca7k_recv_bind(msgs[0].data);
+
+    /* The chip is read at most once, the first descriptor not filled gets the state it ended at */
+    size_t n = 0;
+    bool refilled = false;
+    while (n < count)
+    {
+        qca7k_state_t res = qca7k_recv_staged(&refilled);
+        if (res != QCA7K_OK)
+        {
+            msgs[n].status = res;
+            break;
+        }
+
+        msgs[n].size = _g_dev->recv_len;
+        msgs[n].status = QCA7K_OK;
+        if (++n == count)
+            break;
+        if (!msgs[n].data)
+        {
+            msgs[n].status = QCA7K_NULL_RECV_BUFFER;
+            break;
+        }
+        qca7k_reset_state_machine(msgs[n].data);
+    }
+
+    return n;
+}
+
+uint16_t qca7k_frame_ethertype(const uint8_t* data, size_t size, size_t* payload)
+{
+    /* EtherType follows the MACs, possibly behind a VLAN tag */
+    if (size < 14)
+    {
+        if (payload)
+            *payload = size;
+        return 0;
+    }
+    size_t offset = 14;
+    uint16_t type = ((uint16_t)data[12]) << 8 | data[13];
+    if (type == QCA7K_ETHERTYPE_VLAN && size >= 18)
+    {
+        type = ((uint16_t)data[16]) << 8 | data[17];
+        offset = 18;
+    }
+
+    if (payload)
+        *payload = offset;
+    return type;
+}
+
+bool qca7k_frame_is_mgmt(const uint8_t* data, size_t size)
+{
+    uint16_t type = qca7k_frame_ethertype(data, size, NULL);
+    return type == QCA7K_ETHERTYPE_HOMEPLUG || type == QCA7K_ETHERTYPE_MEDIAXTREAM;
+}
+
+void qca7k_rx_filter(const qca7k_rx_filter_t* filter)
+{
+    _g_dev->filtering = filter != NULL;
+    if (filter)
+        _g_dev->filter = *filter;
+}
+
+void qca7k_rx_filter_stats(qca7k_rx_filter_stats_t* stats)
+{
+    if (stats)
+        *stats = _g_dev->filter_stats;
+}
+
+/** Check the head of a frame against the filter
+ * @param size  at least QCA7K_FRAME_HEAD_SIZE
+ * @return      true if the frame passes
+ */
+static bool qca7k_rx_match(const uint8_t* data, size_t size)
+{
+    const qca7k_rx_filter_t* filter = &_g_dev->filter;
+
+    /* Destination, the group bit tells broadcast and multicast from unicast */
+    static const uint8_t any[6] = { 0 }, broadcast[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    if (data[0] & 0x01)
+    {
+        if (!memcmp(data, broadcast, 6) ? !filter->broadcast : !filter->multicast)
+            return false;
+    }
+    else if (memcmp(filter->mac, any, 6) && memcmp(data, filter->mac, 6))
+        return false;
+
+    /* VLAN ID is in the lower 12 bits of the tag */
+    uint16_t type = qca7k_frame_ethertype(data, size, NULL);
+    if (filter->vlan && data[12] == (QCA7K_ETHERTYPE_VLAN >> 8) && data[13] == (QCA7K_ETHERTYPE_VLAN & 0xFF)
+        && ((((uint16_t)data[14]) << 8 | data[15]) & 0x0FFF) != filter->vlan)
+        return false;
+
+    if (!filter->ethertypes)
+        return true;
+    for (size_t i = 0; i < filter->ethertype_count; i++)
+    {
+        if (filter->ethertypes[i] == type)
+            return true;
+    }
+    for (size_t i = 0; i < filter->handler_count; i++)
+    {
+        if (filter->handlers[i].ethertype == type)
+            return true;
+    }
+    return false;
+}
+
+/** Check the head of a frame against the filter of the selected device, counting the drops */
+static bool qca7k_rx_accept(const uint8_t* data, size_t size)
+{
+    if (!_g_dev->filtering || qca7k_rx_match(data, size))
+        return true;
+
+    _g_dev->filter_stats.dropped++;
+    return false;
+}
+
+/** Check if the handler takes the frame */
+static bool qca7k_rx_handles(const qca7k_rx_handler_t* handler, uint16_t type, const uint8_t* data, size_t size, size_t payload)
+{
+    static const uint8_t any[3] = { 0 };
+    if (handler->ethertype != type)
+        return false;
+    if (!memcmp(handler->oui, any, 3))
+        return true;
+
+    /* MME header: version, type (little endian), fragmentation info from version 1.1 on, then the OUI of vendor MMEs */
+    if (size < payload + 3)
+        return false;
+    size_t oui = payload + (data[payload] ? 5 : 3);
+    if (size < oui + 3)
+        return false;
+    uint16_t mmtype = data[payload + 1] | ((uint16_t)data[payload + 2]) << 8;
+    return mmtype >= 0xA000 && mmtype <= 0xBFFF && !memcmp(data + oui, handler->oui, 3);
+}
+
+/** Give a complete frame to its handler
+ * @return      true if a handler took it
+ */
+static bool qca7k_rx_dispatch(const uint8_t* data, size_t size)
+{
+    if (!_g_dev->filtering || !_g_dev->filter.handler_count)
+        return false;
+
+    size_t payload;
+    uint16_t type = qca7k_frame_ethertype(data, size, &payload);
+    if (!type)
+        return false;
+    for (size_t i = 0; i < _g_dev->filter.handler_count; i++)
+    {
+        const qca7k_rx_handler_t* handler = &_g_dev->filter.handlers[i];
+        if (qca7k_rx_handles(handler, type, data, size, payload))
+        {
+            _g_dev->filter_stats.handled++;
+            handler->handle(handler->ctx, data, size);
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Byte of the backlog ring at the offset from the position */
+static inline uint8_t* qca7k_backlog_at(size_t pos, size_t offset)
+{
+    return &_g_dev->backlog.buf[(pos + offset) % QCA7K_BACKLOG_SIZE];
+}
+
+/** Size of the record at the position including the header */
+static inline size_t qca7k_backlog_record_size(size_t pos)
+{
+    return QCA7K_BACKLOG_HDR + (*qca7k_backlog_at(pos, 0) | ((size_t)*qca7k_backlog_at(pos, 1)) << 8);
+}
+
+/** Account for a dropped record */
+static inline void qca7k_backlog_count_drop(uint32_t* counter, bool mgmt)
+{
+    (*counter)++;
+    if (mgmt)
+        _g_dev->backlog.stats.dropped_mgmt++;
+}
+
+/** Drop the oldest record */
+static void qca7k_backlog_drop_head()
+{
+    size_t rec = qca7k_backlog_record_size(_g_dev->backlog.head);
+    qca7k_backlog_count_drop(&_g_dev->backlog.stats.dropped_head, *qca7k_backlog_at(_g_dev->backlog.head, 2) & QCA7K_BACKLOG_MGMT);
+    _g_dev->backlog.head = (_g_dev->backlog.head + rec) % QCA7K_BACKLOG_SIZE;
+    _g_dev->backlog.used -= rec;
+    _g_dev->backlog.count--;
+}
+
+/** Drop the oldest bulk record
+ * @return      false if there are only management records
+ */
+static bool qca7k_backlog_drop_bulk()
+{
+    size_t offset = 0;
+    for (size_t i = 0; i < _g_dev->backlog.count; i++)
+    {
+        size_t pos = (_g_dev->backlog.head + offset) % QCA7K_BACKLOG_SIZE;
+        size_t rec = qca7k_backlog_record_size(pos);
+        if (!(*qca7k_backlog_at(pos, 2) & QCA7K_BACKLOG_MGMT))
+        {
+            /* Close the gap by moving the older records forward, the overload path can afford it */
+            for (size_t j = offset; j-- > 0;)
+                *qca7k_backlog_at(_g_dev->backlog.head, j + rec) = *qca7k_backlog_at(_g_dev->backlog.head, j);
+            _g_dev->backlog.head = (_g_dev->backlog.head + rec) % QCA7K_BACKLOG_SIZE;
+            _g_dev->backlog.used -= rec;
+            _g_dev->backlog.count--;
+            _g_dev->backlog.stats.dropped_bulk++;
+            return true;
+        }
+        offset += rec;
+    }
+    return false;
+}
+
+/** Put a frame into the backlog according to the policy */
+static void qca7k_backlog_push(const uint8_t* data, size_t size)
+{
+    bool mgmt = qca7k_frame_is_mgmt(data, size);
+    size_t rec = QCA7K_BACKLOG_HDR + size;
+
+    /* Make room if the policy allows it */
+    while (rec > QCA7K_BACKLOG_SIZE - _g_dev->backlog.used)
+    {
+        if (rec > QCA7K_BACKLOG_SIZE || _g_dev->backlog.policy == QCA7K_DROP_TAIL)
+            break;
+        if (_g_dev->backlog.policy == QCA7K_DROP_HEAD)
+            qca7k_backlog_drop_head();
+        else if (!mgmt || !qca7k_backlog_drop_bulk())
+            break;
+    }
+
+    if (rec > QCA7K_BACKLOG_SIZE - _g_dev->backlog.used)
+    {
+        qca7k_backlog_count_drop(&_g_dev->backlog.stats.dropped_tail, mgmt);
+        return;
+    }
+
+    size_t pos = (_g_dev->backlog.head + _g_dev->backlog.used) % QCA7K_BACKLOG_SIZE;
+    *qca7k_backlog_at(pos, 0) = (uint8_t)size;
+    *qca7k_backlog_at(pos, 1) = (uint8_t)(size >> 8);
+    *qca7k_backlog_at(pos, 2) = mgmt ? QCA7K_BACKLOG_MGMT : 0x00;
+    for (size_t i = 0; i < size; i++)
+        *qca7k_backlog_at(pos, QCA7K_BACKLOG_HDR + i) = data[i];
+
+    _g_dev->backlog.used += rec;
+    _g_dev->backlog.count++;
+    _g_dev->backlog.stats.queued++;
+}
+
+void qca7k_backlog_policy(qca7k_drop_policy_t policy)
+{
+    _g_dev->backlog.policy = policy;
+}
+
+qca7k_state_t qca7k_backlog_fill()
+{
+    qca7k_state_t res;
+    while ((res = qca7k_recv(_g_dev->backlog_frame)) == QCA7K_OK)
+        qca7k_backlog_push(_g_dev->backlog_frame, _g_dev->recv_len);
+
+    return res;
+}
+
+qca7k_state_t qca7k_backlog_pop(uint8_t* data, size_t* size)
+{
+    if (!data)
+        return QCA7K_NULL_RECV_BUFFER;
+    if (!_g_dev->backlog.count)
+        return QCA7K_EMPTY_BACKLOG;
+
+    size_t rec = qca7k_backlog_record_size(_g_dev->backlog.head);
+    for (size_t i = 0; i < rec - QCA7K_BACKLOG_HDR; i++)
+        data[i] = *qca7k_backlog_at(_g_dev->backlog.head, QCA7K_BACKLOG_HDR + i);
+    if (size)
+        *size = rec - QCA7K_BACKLOG_HDR;
+
+    _g_dev->backlog.head = (_g_dev->backlog.head + rec) % QCA7K_BACKLOG_SIZE;
+    _g_dev->backlog.used -= rec;
+    _g_dev->backlog.count--;
+    return QCA7K_OK;
+}
+
+size_t qca7k_backlog_count()
+{
+    return _g_dev->backlog.count;
+}
+
+void qca7k_backlog_stats(qca7k_backlog_stats_t* stats)
+{
+    if (stats)
+        *stats = _g_dev->backlog.stats;
+}
+
+void qca7k_backlog_clear()
+{
+    _g_dev->backlog.head = 0;
+    _g_dev->backlog.used = 0;
+    _g_dev->backlog.count = 0;
+    _g_dev->backlog.stats = (qca7k_backlog_stats_t){ 0 };
+}
+
+/** Find the next complete frame in the staging buffer, skipping everything that is not one
+ * @param offset    pointer to store the offset of the frame data
+ * @param size      pointer to store the frame length
+ * @return          QCA7K_OK if found, state of the incomplete frame otherwise
+ */
+static qca7k_state_t qca7k_staging_scan(size_t* offset, size_t* size)
+{
+    const uint8_t* buf = _g_dev->staging.buf;
+    for (; _g_dev->staging.start < _g_dev->staging.fill; _g_dev->staging.start++)
+    {
+        size_t i = _g_dev->staging.start, left = _g_dev->staging.fill - i;
+
+        /* Start of Frame */
+        size_t sof = 0;
+        while (sof < 4 && sof < left && buf[i + sof] == QCA7K_SOF)
+            sof++;
+        if (sof < 4)
+        {
+            if (sof == left)
+                return QCA7K_READING_SOF;
+            continue;
+        }
+        if (left < 6)
+            return QCA7K_READING_FL;
+
+        /* Frame length (little endian) has to make sense */
+        size_t fl = buf[i + 4] | ((size_t)buf[i + 5]) << 8;
+        if (fl < QCA7K_FRAME_MIN || fl > QCA7K_FRAME_MAX)
+        {
+            _g_dev->rx_stats.bad_length++;
+            continue;
+        }
+
+        /* Reserved */
+        if (left < 8)
+            return QCA7K_READING_RESERVED;
+        if (buf[i + 6] != QCA7K_RESERVED || buf[i + 7] != QCA7K_RESERVED)
+        {
+            _g_dev->rx_stats.bad_framing++;
+            continue;
+        }
+
+        /* Frame and End of Frame */
+        if (left < 8 + fl)
+            return QCA7K_READING_FRAME;
+        if (left < 8 + fl + 2)
+            return QCA7K_READING_EOF;
+        if (buf[i + 8 + fl] != QCA7K_EOF || buf[i + 8 + fl + 1] != QCA7K_EOF)
+        {
+            _g_dev->rx_stats.bad_framing++;
+            continue;
+        }
+
+        *offset = i + 8;
+        *size = fl;
+        _g_dev->staging.start = i + 8 + fl + 2;
+        return QCA7K_OK;
+    }
+    return QCA7K_READING_SOF;
+}
+
+/** Find the next complete frame in the staging buffer the filter passes and no handler takes */
+static qca7k_state_t qca7k_staging_next(size_t* offset, size_t* size)
+{
+    qca7k_state_t res;
+    const uint8_t* buf = _g_dev->staging.buf;
+    while ((res = qca7k_staging_scan(offset, size)) == QCA7K_OK)
+    {
+        if (qca7k_rx_accept(buf + *offset, *size) && !qca7k_rx_dispatch(buf + *offset, *size))
+            break;
+    }
+    return res;
+}
+
+qca7k_state_t qca7k_recv_view(qca7k_view_t* view)
+{
+    if (!view)
+        return QCA7K_NULL_RECV_BUFFER;
+
+    size_t offset, size;
+    qca7k_state_t res = qca7k_staging_next(&offset, &size);
+    if (res != QCA7K_OK)
+    {
+        if (_g_dev->staging.views)
+            return QCA7K_VIEWS_HELD;
+
+        /* Nobody looks at the staging buffer, keep only the incomplete frame and refill */
+        if (!qca7k_staging_refill(SIZE_MAX))
+            return QCA7K_EMPTY_READ_BUFFER;
+
+        if ((res = qca7k_staging_next(&offset, &size)) != QCA7K_OK)
+            return res;
+    }
+
+    view->data = _g_dev->staging.buf + offset;
+    view->size = size;
+    _g_dev->staging.views++;
+    return QCA7K_OK;
+}
+
+void qca7k_view_release(qca7k_view_t* view)
+{
+    if (view && view->data && _g_dev->staging.views)
+    {
+        _g_dev->staging.views--;
+        view->data = NULL;
+        view->size = 0;
+    }
+}
+
+size_t qca7k_recv_stream(const qca7k_stream_t* stream)
+{
+    if (!stream || !stream->chunk)
+        return 0;
+    _g_dev->stream.stream = stream;
+
+    /* Only a chunk is ever held, the rest stays in the chip until its turn */
+    uint8_t chunk[QCA7K_STREAM_CHUNK];
+    size_t bytes_available = qca7k_read_available(), frames = 0;
+    if (!bytes_available)
+    {
+        if (qca7k_decoder_partial(&_g_dev->stream) && qca7k_recv_stalled())
+        {
+            _g_dev->rx_stats.timeouts++;
+            qca7k_decoder_abort(&_g_dev->stream);
+        }
+        return 0;
+    }
+
+    while (bytes_available)
+    {
+        size_t n = bytes_available < sizeof(chunk) ? bytes_available : sizeof(chunk);
+        qca7k_write_buffer_size(n);
+
+        qca7k_bus_begin();
+        qca7k_write_command(true, false, 0x0000);
+        qca7k_read_bytes(chunk, n);
+        qca7k_bus_end();
+        bytes_available -= n;
+
+        frames += qca7k_decoder_feed_all(&_g_dev->stream, chunk, n);
+    }
+    qca7k_recv_activity();
+
+    return frames;
+}
+
+qca7k_frame_t* qca7k_frame_alloc()
+{
+    /* The pool is small, a scan claiming a free buffer with a CAS is cheaper than keeping a free list consistent */
+    for (size_t i = 0; i < QCA7K_POOL_FRAMES; i++)
+    {
+        uint32_t free_refs = 0;
+        if (__atomic_compare_exchange_n(&_g_pool[i].refs, &free_refs, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            _g_pool[i].size = 0;
+            return &_g_pool[i];
+        }
+    }
+    return NULL;
+}
+
+qca7k_frame_t* qca7k_frame_ref(qca7k_frame_t* frame)
+{
+    if (frame)
+        __atomic_add_fetch(&frame->refs, 1, __ATOMIC_RELAXED);
+    return frame;
+}
+
+void qca7k_frame_unref(qca7k_frame_t* frame)
+{
+    if (frame)
+        __atomic_sub_fetch(&frame->refs, 1, __ATOMIC_RELEASE);
+}
+
+size_t qca7k_pool_available()
+{
+    size_t res = 0;
+    for (size_t i = 0; i < QCA7K_POOL_FRAMES; i++)
+        if (!__atomic_load_n(&_g_pool[i].refs, __ATOMIC_RELAXED))
+            res++;
+    return res;
+}
+
+qca7k_state_t qca7k_recv_frame(qca7k_frame_t** frame)
+{
+    return qca7k_recv_frame_budget(frame, NULL);
+}
+
+qca7k_state_t qca7k_recv_frame_budget(qca7k_frame_t** frame, qca7k_budget_t* budget)
+{
+    if (!frame)
+        return QCA7K_NULL_RECV_BUFFER;
+
+    /* Keep receiving into the same buffer until the frame is complete */
+    if (!_g_dev->pool_rx && !(_g_dev->pool_rx = qca7k_frame_alloc()))
+        return QCA7K_POOL_EXHAUSTED;
+
+    qca7k_state_t res = qca7k_recv_budget(QCA7K_FRAME_DATA(_g_dev->pool_rx), budget);
+    if (res == QCA7K_OK)
+    {
+        _g_dev->pool_rx->size = _g_dev->recv_len;
+        *frame = _g_dev->pool_rx;
+        _g_dev->pool_rx = NULL;
+    }
+    /* Nothing started, the buffer is better off in the pool */
+    else if (res == QCA7K_EMPTY_READ_BUFFER && !qca7k_recv_partial())
+    {
+        qca7k_frame_unref(_g_dev->pool_rx);
+        _g_dev->pool_rx = NULL;
+    }
+    return res;
+}
+
+qca7k_state_t qca7k_send_frame(qca7k_frame_t* frame)
+{
+    if (!frame)
+        return QCA7K_INVALID_ARGUMENT;
+
+    /* The buffer has the headroom and tailroom around the data, so the frame can be framed in place
+     * NOTE: the padding goes into the data beyond the frame */
+    return qca7k_send_inplace(frame->buf, frame->size);
+}
+
+/** Compose a command word, see qca7k_write_command */
+static inline uint16_t qca7k_command(bool rw, bool in, uint16_t reg)
+{
+    uint16_t res = in ? ( (reg << 2) >> 2 ) : 0x0000;
+    res |= ((uint16_t) rw) << 15 | ((uint16_t) in) << 14;
+    return res;
+}
+
+/** Add a transfer to the transaction
+ * @return      the transfer, NULL if there is no room
+ */
+static qca7k_spi_xfer_t* qca7k_txn_add(qca7k_txn_t* txn, bool rw, bool in, uint16_t reg)
+{
+    if (txn->count >= QCA7K_TXN_OPS)
+    {
+        txn->overflow = true;
+        return NULL;
+    }
+
+    qca7k_spi_xfer_t* xfer = &txn->xfers[txn->count];
+    uint16_t cmd = qca7k_command(rw, in, reg);
+    xfer->cmd[0] = (uint8_t)(cmd >> 8);
+    xfer->cmd[1] = (uint8_t)cmd;
+    xfer->tx = NULL;
+    xfer->tx_size = 0;
+    xfer->rx = NULL;
+    xfer->rx_size = 0;
+    txn->results[txn->count] = NULL;
+    txn->count++;
+    return xfer;
+}
+
+void qca7k_txn_init(qca7k_txn_t* txn)
+{
+    txn->count = 0;
+    txn->overflow = false;
+}
+
+qca7k_state_t qca7k_txn_read(qca7k_txn_t* txn, uint16_t reg, uint16_t* val)
+{
+    qca7k_spi_xfer_t* xfer = qca7k_txn_add(txn, true, true, reg);
+    if (!xfer)
+        return QCA7K_TXN_FULL;
+
+    xfer->rx = txn->values[txn->count - 1];
+    xfer->rx_size = 2;
+    txn->results[txn->count - 1] = val;
+    return QCA7K_OK;
+}
+
+qca7k_state_t qca7k_txn_write(qca7k_txn_t* txn, uint16_t reg, uint16_t val)
+{
+    qca7k_spi_xfer_t* xfer = qca7k_txn_add(txn, false, true, reg);
+    if (!xfer)
+        return QCA7K_TXN_FULL;
+
+    uint8_t* value = txn->values[txn->count - 1];
+    value[0] = (uint8_t)(val >> 8);
+    value[1] = (uint8_t)val;
+    xfer->tx = value;
+    xfer->tx_size = 2;
+    return QCA7K_OK;
+}
+
+qca7k_state_t qca7k_txn_read_ext(qca7k_txn_t* txn, uint8_t* data, size_t size)
+{
+    qca7k_spi_xfer_t* xfer = qca7k_txn_add(txn, true, false, 0x0000);
+    if (!xfer)
+        return QCA7K_TXN_FULL;
+
+    xfer->rx = data;
+    xfer->rx_size = size;
+    return QCA7K_OK;
+}
+
+qca7k_state_t qca7k_txn_write_ext(qca7k_txn_t* txn, const uint8_t* data, size_t size)
+{
+    qca7k_spi_xfer_t* xfer = qca7k_txn_add(txn, false, false, 0x0000);
+    if (!xfer)
+        return QCA7K_TXN_FULL;
+
+    xfer->tx = data;
+    xfer->tx_size = size;
+    return QCA7K_OK;
+}
+
+qca7k_state_t qca7k_txn_submit(qca7k_txn_t* txn)
+{
+    if (txn->overflow)
+    {
+        qca7k_txn_init(txn);
+        return QCA7K_TXN_FULL;
+    }
+
+#ifdef QCA7K_HAVE_SPI_BATCH
+    /* The driver gets the transfers as one submission, so the bus is held for all of them */
+    qca7k_bus_acquire();
+    qca7k_spi_transfer(txn->xfers, txn->count);
+    qca7k_bus_release();
+#else
+    for (size_t i = 0; i < txn->count; i++)
+    {
+        qca7k_spi_xfer_t* xfer = &txn->xfers[i];
+        qca7k_bus_begin();
+        qca7k_write_bytes(xfer->cmd, 2);
+        qca7k_command_gap();
+        qca7k_write_bytes(xfer->tx, xfer->tx_size);
+        qca7k_read_bytes(xfer->rx, xfer->rx_size);
+        qca7k_bus_end();
+    }
+#endif
+
+    /* Scatter the register values */
+    for (size_t i = 0; i < txn->count; i++)
+    {
+        if (txn->results[i])
+            *txn->results[i] = ((uint16_t)txn->values[i][0]) << 8 | txn->values[i][1];
+    }
+
+    qca7k_txn_init(txn);
+    return QCA7K_OK;
+}
+
+void qca7k_write_command(bool rw, bool in, uint16_t reg)
+{
+    qca7k_write_register(qca7k_command(rw, in, reg));
+    qca7k_command_gap();
+}
+
+void qca7k_write_register(uint16_t val)
+{
+#ifdef QCA7K_HAVE_SPI_WORD16
+    qca7k_spi_write16(val);
+#else
+    union
+    {
+        uint16_t val;
+        uint8_t bytes[2];
+    } res;
+    res.val = val;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint16_t t = res.bytes[0];
+    res.bytes[0] = res.bytes[1];
+    res.bytes[1] = t;
+#endif
+    qca7k_spi_write(res.bytes[0]);
+    qca7k_spi_write(res.bytes[1]);
+#endif
+}
+
+uint16_t qca7k_read_register()
+{
+#ifdef QCA7K_HAVE_SPI_WORD16
+    return qca7k_spi_read16();
+#else
+    /* Registers come in big endian, same as we write them */
+    uint16_t res = ((uint16_t)qca7k_spi_read()) << 8;
+    res |= (uint16_t)qca7k_spi_read();
+    return res;
+#endif
+}
+
+uint16_t qca7k_interrupts_get()
+{
+    qca7k_bus_begin();
+    qca7k_write_command(true, true, QCA7K_REG_INTR_ENABLE);
+    uint16_t res= qca7k_read_register();
+    qca7k_bus_end();
+
+    return res;
+}
+
+void qca7k_interrupts_set(uint16_t mask)
+{
+    qca7k_bus_begin();
+    qca7k_write_command(false, true, QCA7K_REG_INTR_ENABLE);
+    qca7k_write_register(mask);
+    qca7k_bus_end();
 }
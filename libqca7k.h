@@ -19,6 +19,9 @@
 * permissions and limitations under the Licence.
 */
 
+#ifndef LIBQCA7K_H
+#define LIBQCA7K_H
+
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -30,50 +33,139 @@ extern "C" {
 /* Register definitions from in-tech smart charging GmbH (I2SE) documenation for PLC stamp mini 2
  * NOTE: Possibly a subset of what is actually available on the chip */
 /** Buffer size setup before data transfer (W) */
-const uint32_t QCA7K_REG_BFR_SIZE       = 0x0100;
+static const uint32_t QCA7K_REG_BFR_SIZE       = 0x0100;
 /** Write buffer space available (R) */ 
-const uint32_t QCA7K_REG_WRBUF_SPC_AVA  = 0x0200;
+static const uint32_t QCA7K_REG_WRBUF_SPC_AVA  = 0x0200;
 /** Read buffer data available (R) */
-const uint32_t QCA7K_REG_RDBUF_BYTE_AVA = 0x0300;
+static const uint32_t QCA7K_REG_RDBUF_BYTE_AVA = 0x0300;
 /** Settings register (R/W)
  * Most of the settings not known, do a read-modify-write cycle to work with it */
-const uint32_t QCA7K_REG_SPI_CONFIG     = 0x0400;
+static const uint32_t QCA7K_REG_SPI_CONFIG     = 0x0400;
 /** Reason for hardware interrupt (R/W)
  * Write to confirm the interrupt */
-const uint32_t QCA7K_REG_INTR_CAUSE     = 0x0C00;
+static const uint32_t QCA7K_REG_INTR_CAUSE     = 0x0C00;
 /** Interrup reasons setup mask (R/W) */
-const uint32_t QCA7K_REG_INTR_ENABLE    = 0x0D00;
+static const uint32_t QCA7K_REG_INTR_ENABLE    = 0x0D00;
 /** Signature command to verify connectivity and endianness (R) */
-const uint32_t QCA7K_REG_SIGNATURE      = 0x1A00;
+static const uint32_t QCA7K_REG_SIGNATURE      = 0x1A00;
 
 /* Settings (not exhaustive) */
 /** Reset the device */
-const uint32_t QCA7K_SLAVE_RESET_BIT    = 1 << 6;
+static const uint32_t QCA7K_SLAVE_RESET_BIT    = 1 << 6;
 
 /* Interrupt reasons */
 /** Device performed a startup */
-const uint32_t QCA7K_INT_CPU_ON         = 1 << 6;
+static const uint32_t QCA7K_INT_CPU_ON         = 1 << 6;
 /** Write buffer error */
-const uint32_t QCA7K_INT_WRBUF_ERR      = 1 << 2;
+static const uint32_t QCA7K_INT_WRBUF_ERR      = 1 << 2;
 /** Read buffer error */
-const uint32_t QCA7K_INT_RDBUF_ERR      = 1 << 1;
+static const uint32_t QCA7K_INT_RDBUF_ERR      = 1 << 1;
 /** Data available to read */
-const uint32_t QCA7K_INT_PKT_AVLBL      = 1 << 0;
+static const uint32_t QCA7K_INT_PKT_AVLBL      = 1 << 0;
 
 /** Signature value */
-const uint32_t QCA7K_SIGNATURE          = 0xAA55;
+static const uint32_t QCA7K_SIGNATURE          = 0xAA55;
+/** Write buffer size, WRBUF_SPC_AVA reads this once everything written has been sent */
+static const uint32_t QCA7K_WRBUF_SIZE         = 3163;
 
+/** Maximum frame size, usable for static storage sizes */
+#define QCA7K_FRAME_MAX_SIZE 1522
 /** Maximum frame size */
-const size_t QCA7K_FRAME_MAX            = 1522;
+static const size_t QCA7K_FRAME_MAX            = QCA7K_FRAME_MAX_SIZE;
+/** Minimum frame size, usable for static storage sizes */
+#define QCA7K_FRAME_MIN_SIZE 60
 /** Minimum frame size (will be padded) */
-const size_t QCA7K_FRAME_MIN            = 60;
+static const size_t QCA7K_FRAME_MIN            = QCA7K_FRAME_MIN_SIZE;
+
+/** Room to leave before the frame for in-place transmit: command, SOF, FL and reserved */
+#define QCA7K_TX_HEADROOM 10
+/** Room to leave after the frame for in-place transmit: EOF */
+#define QCA7K_TX_TAILROOM 2
+/** In-place transmit buffer size for a frame of given length, includes padding to the minimum size */
+#define QCA7K_TX_BUFFER_SIZE(size) (QCA7K_TX_HEADROOM + ((size) < 60 ? 60 : (size)) + QCA7K_TX_TAILROOM)
+
+/** Bytes of a frame enough to filter it: destination and source MAC, VLAN tag and EtherType */
+#define QCA7K_FRAME_HEAD_SIZE 18
 
 /** Start of Frame (repeated 4 times)  */
-const uint8_t QCA7K_SOF                 = 0xAA;
+static const uint8_t QCA7K_SOF                 = 0xAA;
 /** Padding bytes */
-const uint8_t QCA7K_RESERVED            = 0x00;
+static const uint8_t QCA7K_RESERVED            = 0x00;
 /** End of Frame (repeated 2 times) */
-const uint8_t QCA7K_EOF                 = 0x55;
+static const uint8_t QCA7K_EOF                 = 0x55;
+
+/** EtherType of HomePlug AV management messages */
+static const uint16_t QCA7K_ETHERTYPE_HOMEPLUG = 0x88E1;
+/** EtherType of vendor (Qualcomm/Atheros) management messages */
+static const uint16_t QCA7K_ETHERTYPE_MEDIAXTREAM = 0x8912;
+/** EtherType of 802.1Q VLAN tag */
+static const uint16_t QCA7K_ETHERTYPE_VLAN     = 0x8100;
+/** EtherType of IPv6 */
+static const uint16_t QCA7K_ETHERTYPE_IPV6     = 0x86DD;
+
+/* Compile time settings, override with -D if needed */
+#ifndef QCA7K_DEVICES
+/** Number of modems driven by the library, each one gets its own receive state, staging buffer and backlog */
+#define QCA7K_DEVICES 1
+#endif
+
+/* Define QCA7K_THREADS when several threads drive devices at once, each one then has its own device selection
+ * NOTE: a device still may only be used by one thread at a time */
+
+#ifndef QCA7K_BACKLOG_SIZE
+/** Receive backlog storage in bytes, every queued frame takes its length plus 3 bytes */
+#define QCA7K_BACKLOG_SIZE 8192
+#endif
+
+#ifndef QCA7K_POOL_FRAMES
+/** Number of frame buffers in the pool, each takes QCA7K_FRAME_MAX bytes */
+#define QCA7K_POOL_FRAMES 8
+#endif
+
+#ifndef QCA7K_STAGING_SIZE
+/** Read staging buffer for zero-copy receive, must fit at least one framed QCA7K_FRAME_MAX frame */
+#define QCA7K_STAGING_SIZE 4096
+#endif
+
+#ifndef QCA7K_BUDGET_CHUNK
+/** Bytes read between time budget checks */
+#define QCA7K_BUDGET_CHUNK 256
+#endif
+
+#ifndef QCA7K_STREAM_CHUNK
+/** Bytes read at once by the streaming receive, taken from the stack */
+#define QCA7K_STREAM_CHUNK 128
+#endif
+
+#ifndef QCA7K_PIPELINE_CHUNK
+/** Bytes per asynchronous read when receiving with QCA7K_HAVE_SPI_ASYNC, one is parsed while the next is read */
+#define QCA7K_PIPELINE_CHUNK 256
+#endif
+
+#ifndef QCA7K_BOOT_RESETS
+/** Resets the bring-up issues before giving up on a device that does not come up */
+#define QCA7K_BOOT_RESETS 3
+#endif
+
+#ifndef QCA7K_BOOT_ATTEMPTS
+/** Startups the bring-up tries after CPU_ON before resetting again, the chip may not answer right away */
+#define QCA7K_BOOT_ATTEMPTS 8
+#endif
+
+#ifndef QCA7K_TXN_OPS
+/** Maximum number of operations in a transaction builder */
+#define QCA7K_TXN_OPS 8
+#endif
+
+/* Optional shims, define the macro and provide the function to use them
+ * QCA7K_HAVE_SPI_BLOCK     qca7k_spi_read_block, qca7k_spi_write_block
+ * QCA7K_HAVE_SPI_WORD16    qca7k_spi_read16, qca7k_spi_write16
+ * QCA7K_HAVE_SPI_BATCH     qca7k_spi_transfer
+ * QCA7K_HAVE_SPI_ASYNC     qca7k_spi_read_start, qca7k_spi_read_wait
+ * QCA7K_HAVE_SPI_CLOCK     qca7k_spi_clock
+ * QCA7K_HAVE_BUS_LOCK      qca7k_bus_lock, qca7k_bus_unlock
+ * QCA7K_HAVE_TIME          qca7k_time_us
+ */
 
 /* Error and state codes */
 typedef enum
@@ -90,6 +182,20 @@ typedef enum
     QCA7K_NULL_RECV_BUFFER,
     /** Nothing in the read buffer */
     QCA7K_EMPTY_READ_BUFFER,
+    /** Nothing in the receive backlog */
+    QCA7K_EMPTY_BACKLOG,
+    /** No free frame buffers in the pool, release some */
+    QCA7K_POOL_EXHAUSTED,
+    /** Staging buffer has to be refilled but frame views are still held, release them */
+    QCA7K_VIEWS_HELD,
+    /** Too many operations for the transaction builder, see QCA7K_TXN_OPS */
+    QCA7K_TXN_FULL,
+    /** No such device, see QCA7K_DEVICES */
+    QCA7K_NO_DEVICE,
+    /** Queue is full, retry later */
+    QCA7K_QUEUE_FULL,
+    /** Argument out of range, e.g. an empty list */
+    QCA7K_INVALID_ARGUMENT,
     /** The state machine got confused, report this error to me */
     QCA7K_INTERNAL_ERROR,
     /** Waiting for SOF */
@@ -104,7 +210,149 @@ typedef enum
     QCA7K_READING_EOF,
 } qca7k_state_t;
 
+/* SPI transfer modes, the chip is put into one by pin strapping */
+typedef enum
+{
+    /** Chip select is held over the command and the data (default) */
+    QCA7K_SPI_BURST = 0,
+    /** Chip select is toggled between the command and the data */
+    QCA7K_SPI_LEGACY,
+} qca7k_spi_mode_t;
+
+/* Device bring-up states */
+typedef enum
+{
+    /** Bring-up not started, qca7k_startup may have been used directly */
+    QCA7K_BOOT_IDLE = 0,
+    /** Reset issued, waiting for QCA7K_INT_CPU_ON */
+    QCA7K_BOOT_WAITING,
+    /** Signature checked and interrupts enabled */
+    QCA7K_BOOT_READY,
+    /** Did not come up after QCA7K_BOOT_RESETS resets */
+    QCA7K_BOOT_FAILED,
+} qca7k_boot_state_t;
+
+/* Receive backlog drop policies */
+typedef enum
+{
+    /** Drop the incoming frame if it does not fit */
+    QCA7K_DROP_TAIL = 0,
+    /** Drop the oldest queued frames until the incoming one fits */
+    QCA7K_DROP_HEAD,
+    /** Drop the oldest queued bulk frames to fit a management frame, tail drop bulk frames */
+    QCA7K_DROP_BULK_KEEP_MGMT,
+} qca7k_drop_policy_t;
+
+/* Receive backlog counters, all of them only grow until qca7k_backlog_clear() */
+typedef struct
+{
+    /** Frames put into the backlog */
+    uint32_t queued;
+    /** Incoming frames dropped because there was no room */
+    uint32_t dropped_tail;
+    /** Queued frames dropped to make room for newer ones */
+    uint32_t dropped_head;
+    /** Queued bulk frames dropped to make room for a management frame */
+    uint32_t dropped_bulk;
+    /** Management frames among all of the dropped ones */
+    uint32_t dropped_mgmt;
+} qca7k_backlog_stats_t;
+
+/* Receive error counters, each counts a resync */
+typedef struct
+{
+    /** Frame lengths out of the QCA7K_FRAME_MIN..QCA7K_FRAME_MAX range */
+    uint32_t bad_length;
+    /** Reserved or End of Frame bytes that did not match */
+    uint32_t bad_framing;
+    /** Partial frames discarded after the receive timeout */
+    uint32_t timeouts;
+    /** Partial frames discarded because the receive continued into different storage */
+    uint32_t abandoned;
+} qca7k_rx_stats_t;
+
+/* Bus lock counters, only with QCA7K_HAVE_BUS_LOCK */
+typedef struct
+{
+    /** Times the lock was taken, once per chip select framed transaction */
+    uint32_t holds;
+    /** Longest hold in microseconds (needs QCA7K_HAVE_TIME) */
+    uint32_t max_us;
+    /** All holds together in microseconds (needs QCA7K_HAVE_TIME) */
+    uint64_t total_us;
+} qca7k_bus_stats_t;
+
+/* Device bring-up progress */
+typedef struct
+{
+    qca7k_boot_state_t state;
+    /** Resets issued since qca7k_boot_start */
+    uint32_t resets;
+    /** Time from qca7k_boot_start to the device being ready, in microseconds (needs QCA7K_HAVE_TIME) */
+    uint32_t latency_us;
+} qca7k_boot_info_t;
+
+/* SPI clock calibration outcome */
+typedef struct
+{
+    /** Clock set at the end */
+    uint32_t hz;
+    /** Highest clock that passed every check */
+    uint32_t max_hz;
+    /** Failed checks over the whole sweep */
+    uint32_t errors;
+} qca7k_clock_cal_t;
+
+/* Frame descriptor for batch send and receive */
+typedef struct
+{
+    /** Frame to send or storage of at least QCA7K_FRAME_MAX bytes to receive into */
+    uint8_t* data;
+    /** Length of the frame to send or of the received one */
+    size_t size;
+    /** QCA7K_OK if the frame was sent or received, error or state code otherwise */
+    qca7k_state_t status;
+} qca7k_msg_t;
+
+/* Work budget for a single call */
+typedef struct
+{
+    /** Bytes the call may move over the bus, 0 for no limit */
+    size_t bytes;
+    /** Microseconds the call may take, 0 for no limit (needs QCA7K_HAVE_TIME) */
+    uint32_t us;
+    /** Set by the call: bytes still waiting, in the chip (as last seen) and staged for receive, in the descriptors for send */
+    size_t pending;
+    /** Set by the call: bytes moved over the bus */
+    size_t spent;
+} qca7k_budget_t;
+
+/* Frame buffer from the pool, hold and release it with qca7k_frame_ref/qca7k_frame_unref */
+typedef struct
+{
+    /** In-place transmit buffer, the frame data starts at QCA7K_TX_HEADROOM, access it with QCA7K_FRAME_DATA */
+    uint8_t buf[QCA7K_TX_BUFFER_SIZE(QCA7K_FRAME_MAX_SIZE)];
+    /** Frame length */
+    size_t size;
+    /** Reference count, do not touch */
+    uint32_t refs;
+} qca7k_frame_t;
+
+/** Frame data of a pool frame, room for QCA7K_FRAME_MAX bytes */
+#define QCA7K_FRAME_DATA(frame) ((frame)->buf + QCA7K_TX_HEADROOM)
+
 /* High level interface */
+/** Select the device the following calls go to
+ * The shims are not told which device they are called for, they are expected to look at qca7k_selected()
+ * NOTE: the first device is selected initially
+ * @param dev   device number, less than QCA7K_DEVICES
+ * @return      QCA7K_OK on success, QCA7K_NO_DEVICE if there is no such device
+ */
+qca7k_state_t qca7k_select(uint8_t dev);
+
+/** Device the calls go to, for the shims to pick the chip select */
+uint8_t qca7k_selected();
+
 /** Enable all interrupts */
 void qca7k_interrupts_enable_all();
 
@@ -141,6 +389,85 @@ qca7k_state_t qca7k_startup();
 /** Reset the device */
 void qca7k_reset();
 
+/* Asynchronous bring-up
+ * Resets a device and does the qca7k_startup part once it reports QCA7K_INT_CPU_ON, without waiting in between,
+ * so many devices boot at the same time instead of one after another
+ */
+/** Reset the selected device and start waiting for it to come up
+ * Whatever was partially received is dropped, the chip buffers do not survive a reset
+ */
+void qca7k_boot_start();
+
+/** Start the bring-up of every device at once, the selection is kept */
+void qca7k_boot_start_all();
+
+/** Pass interrupt reasons of the selected device to the bring-up
+ * Finishes the startup on QCA7K_INT_CPU_ON. A signature mismatch keeps waiting as the chip is not up yet, the
+ * startup is tried again on each later call (with any reasons) up to QCA7K_BOOT_ATTEMPTS times, then the device
+ * is reset again, after QCA7K_BOOT_RESETS resets it fails
+ * @param reasons   mask from qca7k_interrupt_reasons
+ * @return          bring-up state afterwards
+ */
+qca7k_boot_state_t qca7k_boot_event(uint16_t reasons);
+
+/** Check the interrupt cause of the selected device for QCA7K_INT_CPU_ON, for boards without the interrupt line
+ * @return          bring-up state afterwards
+ */
+qca7k_boot_state_t qca7k_boot_poll();
+
+/** Poll every device still waiting, the selection is kept
+ * @return          number of devices ready
+ */
+size_t qca7k_boot_poll_all();
+
+#ifdef QCA7K_HAVE_TIME
+/** Set how long to wait for QCA7K_INT_CPU_ON before resetting again, after QCA7K_BOOT_RESETS resets the device fails
+ * NOTE: checked by the bring-up calls only, a device that stays silent times out only if qca7k_boot_poll or
+ * qca7k_boot_poll_all is called periodically
+ * @param us    timeout in microseconds, 0 to wait forever (default)
+ */
+void qca7k_boot_timeout(uint32_t us);
+#endif
+
+/** Get the bring-up progress of the selected device
+ * @param info  pointer to store the progress
+ */
+void qca7k_boot_info(qca7k_boot_info_t* info);
+
+#ifdef QCA7K_HAVE_SPI_CLOCK
+/** Find the fastest SPI clock the board handles
+ * Sweeps the rates upwards, checking the signature and INTR_ENABLE write/readback patterns at each one,
+ * until a rate shows an error, then settles the given number of rates below the highest clean one
+ * NOTE: run it before enabling traffic, the interrupt mask is restored afterwards
+ * @param rates     clock rates in Hz, ascending
+ * @param count     number of rates
+ * @param rounds    checks at each rate, at least one
+ * @param margin    number of rates to step back from the highest clean one
+ * @param res       pointer to store the outcome, NULL if not needed
+ * @return          QCA7K_OK on success, QCA7K_BAD_SIGNATURE if even the lowest rate fails,
+ *                  QCA7K_INVALID_ARGUMENT for no rates or no rounds
+ */
+qca7k_state_t qca7k_clock_calibrate(const uint32_t* rates, size_t count, size_t rounds, size_t margin, qca7k_clock_cal_t* res);
+#endif
+
+/** Select the SPI transfer mode matching the chip strapping
+ * There is no known SPI_CONFIG bit to switch it, so this only tells the library how to talk
+ * @param mode  transfer mode, QCA7K_SPI_BURST by default
+ */
+void qca7k_spi_mode(qca7k_spi_mode_t mode);
+
+#ifdef QCA7K_HAVE_BUS_LOCK
+/** Get the bus lock counters of the selected device
+ * The lock is taken around every transaction separately, so a frame transfer holds it for the frame alone
+ * and a send is three holds: the space check, the size announcement and the frame
+ * @param stats pointer to store the counters
+ */
+void qca7k_bus_stats(qca7k_bus_stats_t* stats);
+
+/** Zero the bus lock counters of the selected device */
+void qca7k_bus_stats_clear();
+#endif
+
 /** Send a frame
  * @param data  data to transmit
  * @param size  length of data
@@ -148,15 +475,376 @@ void qca7k_reset();
  */
 qca7k_state_t qca7k_send(uint8_t* data, size_t size);
 
+/** Send a frame framed in place
+ * The framing and padding are written around the frame and the whole buffer goes out in a single transfer
+ * @param buf   buffer of at least QCA7K_TX_BUFFER_SIZE(size) bytes, the frame starts at QCA7K_TX_HEADROOM
+ * @param size  length of the frame
+ * @return      QCA7K_OK on success, QCA7K_INVALID_ARGUMENT for no buffer, error code otherwise
+ */
+qca7k_state_t qca7k_send_inplace(uint8_t* buf, size_t size);
+
 /** Receive a frame
+ * The whole read buffer is read in a single burst announced with BFR_SIZE and staged,
+ * bytes past the end of the frame are kept for the next call
  * The operation may not finish in a single run, keep running it with the same storage pointer on interrupt
- * If run with a different pointer mid-reading, the current packet will be discarded
+ * If run with a different pointer mid-reading, the current packet will be discarded (counted as abandoned)
  * NOTE: this function is not reentrant, make sure it's only called from one place
  * @param data  pointer to storage, must have at least QCA7K_FRAME_MAX bytes allocated
  * @return      QCA7K_OK if full frame is received, error or state code otherwise
  */
 qca7k_state_t qca7k_recv(uint8_t* data);
 
+/** Send as many frames as the write buffer takes
+ * The write buffer space is only checked once for the whole batch
+ * @param msgs  frame descriptors, status of each is updated
+ * @param count number of descriptors
+ * @return      number of descriptors handled, the rest did not fit and are left for later
+ */
+size_t qca7k_send_batch(qca7k_msg_t* msgs, size_t count);
+
+/** Receive as many frames as are in the read buffer, in a single read
+ * A frame left incomplete by the previous call continues if the first descriptor has the same storage
+ * as the one it was left in (the first descriptor not filled), otherwise it is discarded
+ * NOTE: shares the state with qca7k_recv, same rules apply
+ * @param msgs  frame descriptors, status and size of each filled one is updated
+ * @param count number of descriptors
+ * @return      number of frames received, the first descriptor not filled gets the receiving state
+ */
+size_t qca7k_recv_batch(qca7k_msg_t* msgs, size_t count);
+
+/** Receive a frame within a budget
+ * Same as qca7k_recv, but the read buffer is read in pieces until the frame is complete or the budget runs out,
+ * in which case the state of the incomplete frame is returned and the next call resumes it
+ * @param data      pointer to storage, must have at least QCA7K_FRAME_MAX bytes allocated
+ * @param budget    limits, pending work is reported back in it
+ * @return          QCA7K_OK if full frame is received, error or state code otherwise
+ */
+qca7k_state_t qca7k_recv_budget(uint8_t* data, qca7k_budget_t* budget);
+
+#ifdef QCA7K_HAVE_TIME
+/** Set how long a partial frame may wait for the rest of it
+ * Checked whenever a receive finds the read buffer empty, a frame that got stuck is discarded then
+ * @param us    timeout in microseconds, 0 to wait forever (default)
+ */
+void qca7k_recv_timeout(uint32_t us);
+#endif
+
+/** Get the receive error counters
+ * Frame lengths are checked as soon as they are read, so a corrupted header costs at most 8 bytes
+ * @param stats pointer to store the counters
+ */
+void qca7k_rx_stats(qca7k_rx_stats_t* stats);
+
+/** Drop the partial frame and the staged bytes, receiving starts over at the next Start of Frame
+ * Frames in the backlog and views already handed out stay valid
+ */
+void qca7k_recv_resync();
+
+/** Same as qca7k_recv_resync, and read out and drop what the chip has in its read buffer too
+ * @return      number of bytes dropped from the chip
+ */
+size_t qca7k_recv_flush();
+
+/** Send frames within a budget
+ * Same as qca7k_send_batch, but stops at the first frame that would go over the budget
+ * NOTE: the first frame is sent regardless, otherwise a small budget would never let anything through
+ * @param msgs      frame descriptors, status of each is updated
+ * @param count     number of descriptors
+ * @param budget    limits, pending work is reported back in it
+ * @return          number of descriptors handled
+ */
+size_t qca7k_send_budget(qca7k_msg_t* msgs, size_t count, qca7k_budget_t* budget);
+
+/* Receive backlog
+ * A bounded FIFO of received frames of QCA7K_BACKLOG_SIZE bytes, lets the application fall behind the chip
+ * without losing control over memory or over what gets lost
+ * NOTE: uses qca7k_recv internally, do not mix the two
+ */
+/** Select what to drop when the backlog is full
+ * @param policy    drop policy, QCA7K_DROP_TAIL by default
+ */
+void qca7k_backlog_policy(qca7k_drop_policy_t policy);
+
+/** Move all the frames the chip has into the backlog
+ * Run it on interrupt instead of qca7k_recv
+ * @return      receiving state after the last frame, see qca7k_recv
+ */
+qca7k_state_t qca7k_backlog_fill();
+
+/** Take the oldest frame out of the backlog
+ * @param data  pointer to storage, must have at least QCA7K_FRAME_MAX bytes allocated
+ * @param size  pointer to store the frame length
+ * @return      QCA7K_OK if a frame was copied, QCA7K_EMPTY_BACKLOG otherwise
+ */
+qca7k_state_t qca7k_backlog_pop(uint8_t* data, size_t* size);
+
+/** Number of frames waiting in the backlog */
+size_t qca7k_backlog_count();
+
+/** Get the backlog counters
+ * @param stats pointer to store the counters
+ */
+void qca7k_backlog_stats(qca7k_backlog_stats_t* stats);
+
+/** Drop everything queued and zero the counters */
+void qca7k_backlog_clear();
+
+/* Receive filter
+ * Looks at the first QCA7K_FRAME_HEAD_SIZE bytes while the frame is parsed, a dropped frame is read from the chip
+ * but never copied. Frames that pass go to the handler registered for their EtherType, the ones no handler takes
+ * are returned by the receive functions as usual. Applies to every receive function but the streaming one,
+ * which has the head callback for that.
+ */
+/* Handler of one kind of frames */
+typedef struct
+{
+    /** EtherType, behind the VLAN tag if there is one */
+    uint16_t ethertype;
+    /** OUI of HomePlug AV vendor specific MMEs (MMTYPE 0xA000..0xBFFF) to take, all zeroes for any frame of the EtherType */
+    uint8_t oui[3];
+    /** Takes the frame, the data is only valid during the call
+     * NOTE: called from within the receive functions, do not receive from the same device in it
+     */
+    void (*handle)(void* ctx, const uint8_t* data, size_t size);
+    /** Passed to the handler as is */
+    void* ctx;
+} qca7k_rx_handler_t;
+
+/* Receive filter setup */
+typedef struct
+{
+    /** Own address, unicast frames to other addresses are dropped, all zeroes to take any */
+    uint8_t mac[6];
+    /** Take broadcast frames */
+    bool broadcast;
+    /** Take multicast frames other than broadcast */
+    bool multicast;
+    /** VLAN ID tagged frames have to carry, 0 for any, untagged frames always pass */
+    uint16_t vlan;
+    /** EtherTypes to return from the receive functions, NULL for all, frames some handler takes pass regardless */
+    const uint16_t* ethertypes;
+    size_t ethertype_count;
+    /** Handlers, the first one matching gets the frame, so put the ones with an OUI first */
+    const qca7k_rx_handler_t* handlers;
+    size_t handler_count;
+} qca7k_rx_filter_t;
+
+/* Receive filter counters */
+typedef struct
+{
+    /** Frames dropped by address, VLAN or EtherType */
+    uint32_t dropped;
+    /** Frames given to the handlers */
+    uint32_t handled;
+} qca7k_rx_filter_stats_t;
+
+/** Set up the receive filter of the selected device
+ * Takes effect from the next frame on, the setup is copied, the lists it points to are not and have to stay around
+ * @param filter    setup, NULL to take every frame
+ */
+void qca7k_rx_filter(const qca7k_rx_filter_t* filter);
+
+/** Get the receive filter counters of the selected device
+ * @param stats pointer to store the counters
+ */
+void qca7k_rx_filter_stats(qca7k_rx_filter_stats_t* stats);
+
+/** Get the EtherType of a frame
+ * @param data      frame starting with the destination MAC
+ * @param size      length of data
+ * @param payload   set to the offset of the payload (size if the frame is too short), NULL if not needed
+ * @return          EtherType, behind the VLAN tag if there is one, 0 if the frame is too short
+ */
+uint16_t qca7k_frame_ethertype(const uint8_t* data, size_t size, size_t* payload);
+
+/** Check if the frame is a management one (HomePlug AV or vendor MME, VLAN tagged or not)
+ * @param data  frame starting with the destination MAC
+ * @param size  length of data
+ */
+bool qca7k_frame_is_mgmt(const uint8_t* data, size_t size);
+
+/* Frame buffer pool
+ * QCA7K_POOL_FRAMES static buffers shared by reference, so several consumers can hold the same frame
+ * without copies or heap allocation
+ * NOTE: references are taken and released atomically, the rest is as reentrant as qca7k_recv
+ */
+/** Take a free buffer from the pool
+ * @return      frame with a single reference, NULL if the pool is exhausted
+ */
+qca7k_frame_t* qca7k_frame_alloc();
+
+/** Add a reference to the frame for another consumer
+ * @param frame frame to share
+ * @return      the same frame
+ */
+qca7k_frame_t* qca7k_frame_ref(qca7k_frame_t* frame);
+
+/** Release a reference, the frame goes back to the pool with the last one
+ * @param frame frame to release, NULL is ignored
+ */
+void qca7k_frame_unref(qca7k_frame_t* frame);
+
+/** Number of free buffers in the pool */
+size_t qca7k_pool_available();
+
+/** Receive a frame into a pool buffer
+ * Same as qca7k_recv, but the storage is taken from the pool when a frame starts
+ * @param frame pointer to store the received frame, it comes with a single reference for the caller
+ * @return      QCA7K_OK if full frame is received, error or state code otherwise
+ */
+qca7k_state_t qca7k_recv_frame(qca7k_frame_t** frame);
+
+/** Receive a frame into a pool buffer within a budget, see qca7k_recv_budget
+ * @param frame     pointer to store the received frame, it comes with a single reference for the caller
+ * @param budget    limits, pending work is reported back in it, NULL for none
+ * @return          QCA7K_OK if full frame is received, error or state code otherwise
+ */
+qca7k_state_t qca7k_recv_frame_budget(qca7k_frame_t** frame, qca7k_budget_t* budget);
+
+/** Send a pool frame in place, the caller keeps its reference
+ * @param frame frame to transmit
+ * @return      QCA7K_OK on success, QCA7K_INVALID_ARGUMENT for no frame, error code otherwise
+ */
+qca7k_state_t qca7k_send_frame(qca7k_frame_t* frame);
+
+/* Zero-copy receive
+ * Frames are read into the staging buffer in bulk and handed out as views right where they landed
+ * A view stays valid until it is released, the staging buffer is refilled only with no views held
+ * NOTE: shares the staging buffer with qca7k_recv, do not mix the two
+ */
+typedef struct
+{
+    /** Frame data inside the staging buffer */
+    const uint8_t* data;
+    /** Frame length */
+    size_t size;
+} qca7k_view_t;
+
+/** Receive a frame as a view into the staging buffer
+ * Hands out frames already staged first, reads the chip only once they are all out
+ * @param view  pointer to store the view
+ * @return      QCA7K_OK if a frame is out, QCA7K_VIEWS_HELD if the staging buffer needs a refill
+ *              but views are still held, error or state code otherwise
+ */
+qca7k_state_t qca7k_recv_view(qca7k_view_t* view);
+
+/** Release a view, its data must not be touched afterwards
+ * @param view  view to release
+ */
+void qca7k_view_release(qca7k_view_t* view);
+
+/* Streaming receive
+ * Frames are handed over piece by piece while they are being read, no frame sized storage is needed
+ * Every chunk is read in its own SPI transaction, so the callbacks are free to use the bus
+ * NOTE: keeps its own receive state, do not mix with the other receive functions
+ */
+typedef struct
+{
+    /** Frame header is through, return false to skip the frame (optional)
+     * @param size  frame length
+     */
+    bool (*start)(void* ctx, size_t size);
+    /** Next piece of the frame, pieces come in order and add up to the frame length */
+    void (*chunk)(void* ctx, const uint8_t* data, size_t size);
+    /** Frame is over (optional)
+     * @param status    QCA7K_OK if it completed, state it broke at if it was aborted (the data was bad)
+     */
+    void (*end)(void* ctx, qca7k_state_t status);
+    /** Passed to the callbacks as is */
+    void* ctx;
+    /** First QCA7K_FRAME_HEAD_SIZE bytes of the frame are in, return false to skip the frame (optional)
+     * Called before the first chunk, which then starts with the same bytes, so a skipped frame is never copied
+     */
+    bool (*head)(void* ctx, const uint8_t* data, size_t size);
+} qca7k_stream_t;
+
+/** Read what the chip has and pass it to the callbacks as it is parsed
+ * A frame may start in one call and end in a later one
+ * @param stream    callbacks
+ * @return          number of frames completed
+ */
+size_t qca7k_recv_stream(const qca7k_stream_t* stream);
+
+/* Transaction builder
+ * Records register accesses and external transfers and submits them to the bus at once,
+ * e.g. to a single spidev ioctl or a DMA descriptor chain, then puts the register values where asked
+ */
+/* One chip select framed transfer: command, bytes to write, then bytes to read */
+typedef struct
+{
+    /** Command word, MSB first */
+    uint8_t cmd[2];
+    /** Bytes to write after the command */
+    const uint8_t* tx;
+    size_t tx_size;
+    /** Storage for the bytes to read after the command */
+    uint8_t* rx;
+    size_t rx_size;
+} qca7k_spi_xfer_t;
+
+/* Transaction under construction, treat as opaque */
+typedef struct
+{
+    qca7k_spi_xfer_t xfers[QCA7K_TXN_OPS];
+    /** Register values to write or read, MSB first */
+    uint8_t values[QCA7K_TXN_OPS][2];
+    /** Where to put the register values read */
+    uint16_t* results[QCA7K_TXN_OPS];
+    size_t count;
+    bool overflow;
+} qca7k_txn_t;
+
+/** Start an empty transaction
+ * @param txn   transaction to set up
+ */
+void qca7k_txn_init(qca7k_txn_t* txn);
+
+/** Record a register read
+ * @param txn   transaction
+ * @param reg   register
+ * @param val   where to put the value (host byte order) after submitting
+ * @return      QCA7K_OK on success, QCA7K_TXN_FULL if there is no room
+ */
+qca7k_state_t qca7k_txn_read(qca7k_txn_t* txn, uint16_t reg, uint16_t* val);
+
+/** Record a register write
+ * @param txn   transaction
+ * @param reg   register
+ * @param val   value in host byte order
+ * @return      QCA7K_OK on success, QCA7K_TXN_FULL if there is no room
+ */
+qca7k_state_t qca7k_txn_write(qca7k_txn_t* txn, uint16_t reg, uint16_t val);
+
+/** Record an external read, announce its size with a BFR_SIZE write before if needed
+ * @param txn   transaction
+ * @param data  storage to read into, filled after submitting
+ * @param size  number of bytes
+ * @return      QCA7K_OK on success, QCA7K_TXN_FULL if there is no room
+ */
+qca7k_state_t qca7k_txn_read_ext(qca7k_txn_t* txn, uint8_t* data, size_t size);
+
+/** Record an external write, announce its size with a BFR_SIZE write before
+ * @param txn   transaction
+ * @param data  bytes to write, must stay around until submitting
+ * @param size  number of bytes
+ * @return      QCA7K_OK on success, QCA7K_TXN_FULL if there is no room
+ */
+qca7k_state_t qca7k_txn_write_ext(qca7k_txn_t* txn, const uint8_t* data, size_t size);
+
+/** Submit everything recorded and empty the transaction
+ * @param txn   transaction
+ * @return      QCA7K_OK on success, QCA7K_TXN_FULL if some operations did not fit (nothing is submitted)
+ */
+qca7k_state_t qca7k_txn_submit(qca7k_txn_t* txn);
+
+/** Get the interrupt reasons and the buffer levels at once
+ * Same as qca7k_interrupt_reasons, but in two bus submissions instead of five register accesses
+ * @param read_available    pointer to store RDBUF_BYTE_AVA, NULL if not needed
+ * @param write_space       pointer to store WRBUF_SPC_AVA, NULL if not needed
+ * @return                  interrupt reason mask
+ */
+uint16_t qca7k_interrupt_status(uint16_t* read_available, uint16_t* write_space);
+
 /* Shims the user is expected to provide */
 /** Write a byte over SPI */
 void qca7k_spi_write(uint8_t);
@@ -170,6 +858,60 @@ void qca7k_spi_begin();
 /** End an SPI transaction (release CS) */
 void qca7k_spi_end();
 
+#ifdef QCA7K_HAVE_SPI_BLOCK
+/** Read a block of bytes from SPI (optional, e.g. DMA) */
+void qca7k_spi_read_block(uint8_t* data, size_t size);
+
+/** Write a block of bytes over SPI (optional, e.g. DMA) */
+void qca7k_spi_write_block(const uint8_t* data, size_t size);
+#endif
+
+#ifdef QCA7K_HAVE_SPI_ASYNC
+/** Start reading a block of bytes from SPI in the background and return (optional, e.g. DMA)
+ * Only one read is started at a time, the chip select stays as it is */
+void qca7k_spi_read_start(uint8_t* data, size_t size);
+
+/** Wait for the read started last to complete (optional, e.g. DMA) */
+void qca7k_spi_read_wait();
+#endif
+
+#ifdef QCA7K_HAVE_SPI_WORD16
+/** Write a 16 bit word over SPI, MSB first (optional, for 16 bit SPI frames)
+ * Used for commands, registers and frame data, odd bytes still go through qca7k_spi_write */
+void qca7k_spi_write16(uint16_t);
+
+/** Read a 16 bit word from SPI, MSB first (optional, for 16 bit SPI frames) */
+uint16_t qca7k_spi_read16();
+#endif
+
+#ifdef QCA7K_HAVE_SPI_CLOCK
+/** Set the SPI clock (optional, for calibration)
+ * @param hz    clock rate in Hz
+ */
+void qca7k_spi_clock(uint32_t hz);
+#endif
+
+#ifdef QCA7K_HAVE_BUS_LOCK
+/** Take the SPI bus before a transaction, blocking while another device uses it (optional, for shared buses)
+ * Called before qca7k_spi_begin, look at qca7k_selected() if the devices sit on different buses */
+void qca7k_bus_lock();
+
+/** Give the SPI bus back after a transaction (optional, for shared buses) */
+void qca7k_bus_unlock();
+#endif
+
+#ifdef QCA7K_HAVE_TIME
+/** Monotonic time in microseconds, wrapping around is fine (optional, for time budgets and timeouts) */
+uint32_t qca7k_time_us();
+#endif
+
+#ifdef QCA7K_HAVE_SPI_BATCH
+/** Run a sequence of transfers, each one framed by chip select, in one go (optional, e.g. spidev or DMA)
+ * Every transfer writes the command and tx bytes, then reads rx bytes
+ * NOTE: in QCA7K_SPI_LEGACY mode toggle chip select after the command */
+void qca7k_spi_transfer(qca7k_spi_xfer_t* xfers, size_t count);
+#endif
+
 /* Low level interface, you probably don't need to use it */
 /** Write a command header
  * @param rw    read (true) or write (false)
@@ -201,3 +943,5 @@ void qca7k_interrupts_set(uint16_t mask);
 #ifdef __cplusplus
 }
 #endif
+
+#endif
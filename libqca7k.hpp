@@ -0,0 +1,374 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+/* Header-only C++ interface
+ * Same protocol as libqca7k.c, but the SPI transport is a template parameter instead of link time shims,
+ * so the compiler can inline it into the framing loops. Every device object keeps its own receive state.
+ * NOTE: does not need libqca7k.c, the constants and codes come from libqca7k.h
+ */
+
+#ifndef LIBQCA7K_HPP
+#define LIBQCA7K_HPP
+
+#include "libqca7k.h"
+
+namespace qca7k
+{
+
+/** Non-owning view of contiguous memory */
+template <typename T>
+class span
+{
+public:
+    constexpr span() : _data(nullptr), _size(0) {}
+    constexpr span(T* data, size_t size) : _data(data), _size(size) {}
+    template <size_t N>
+    constexpr span(T (&data)[N]) : _data(data), _size(N) {}
+    /** Anything with data() and size(), e.g. std::array or std::vector */
+    template <typename C>
+    constexpr span(C& c) : _data(c.data()), _size(c.size()) {}
+
+    constexpr T* data() const { return _data; }
+    constexpr size_t size() const { return _size; }
+    constexpr span first(size_t n) const { return span(_data, n < _size ? n : _size); }
+    T& operator[](size_t i) const { return _data[i]; }
+
+private:
+    T* _data;
+    size_t _size;
+};
+
+/** Transport with only byte operations, adds the word and block ones on top
+ * Base has to provide begin(), end(), write(uint8_t) and read()
+ */
+template <typename Base>
+struct byte_transport : Base
+{
+    using Base::Base;
+
+    /** Write a word MSB first, the way the chip expects registers and commands */
+    inline void write16(uint16_t v)
+    {
+        this->write((uint8_t)(v >> 8));
+        this->write((uint8_t)v);
+    }
+
+    /** Read a word sent MSB first */
+    inline uint16_t read16()
+    {
+        uint16_t res = ((uint16_t)this->read()) << 8;
+        return res | this->read();
+    }
+
+    inline void write_block(const uint8_t* data, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+            this->write(data[i]);
+    }
+
+    inline void read_block(uint8_t* data, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+            data[i] = this->read();
+    }
+};
+
+/** Byte operations of the C shims, to keep using an existing integration */
+struct shim_bytes
+{
+#ifdef QCA7K_HAVE_BUS_LOCK
+    inline void begin()
+    {
+        qca7k_bus_lock();
+        qca7k_spi_begin();
+    }
+    inline void end()
+    {
+        qca7k_spi_end();
+        qca7k_bus_unlock();
+    }
+#else
+    inline void begin() { qca7k_spi_begin(); }
+    inline void end() { qca7k_spi_end(); }
+#endif
+    inline void write(uint8_t v) { qca7k_spi_write(v); }
+    inline uint8_t read() { return qca7k_spi_read(); }
+};
+typedef byte_transport<shim_bytes> shim_transport;
+
+/** SPI transaction, chip select is held for the lifetime of the object */
+template <typename Transport>
+class transaction
+{
+public:
+    explicit transaction(Transport& t) : _t(t) { _t.begin(); }
+    ~transaction() { _t.end(); }
+    transaction(const transaction&) = delete;
+    transaction& operator=(const transaction&) = delete;
+
+private:
+    Transport& _t;
+};
+
+/** QCA7000 device
+ * Transport has to provide begin(), end(), write(uint8_t), read(), write16(uint16_t), read16(),
+ * write_block(const uint8_t*, size_t) and read_block(uint8_t*, size_t), words go MSB first.
+ * Byte order is dealt with by shifts, so no union swapping or run time checks are involved.
+ */
+template <typename Transport>
+class device
+{
+public:
+    device() = default;
+    explicit device(const Transport& t) : _t(t) {}
+
+    Transport& transport() { return _t; }
+
+    /* Low level interface */
+    /** Command word, see qca7k_write_command */
+    static constexpr uint16_t command(bool rw, bool in, uint16_t reg)
+    {
+        return (uint16_t)((in ? (reg & 0x3FFF) : 0x0000) | ((uint16_t)rw) << 15 | ((uint16_t)in) << 14);
+    }
+
+    uint16_t read_register(uint16_t reg)
+    {
+        transaction<Transport> tr(_t);
+        _t.write16(command(true, true, reg));
+        return _t.read16();
+    }
+
+    void write_register(uint16_t reg, uint16_t val)
+    {
+        transaction<Transport> tr(_t);
+        _t.write16(command(false, true, reg));
+        _t.write16(val);
+    }
+
+    /* High level interface, same as the C one */
+    uint16_t signature() { return read_register(QCA7K_REG_SIGNATURE); }
+    uint16_t interrupts_get() { return read_register(QCA7K_REG_INTR_ENABLE); }
+    void interrupts_set(uint16_t mask) { write_register(QCA7K_REG_INTR_ENABLE, mask); }
+    void interrupts_enable_all()
+    {
+        interrupts_set(QCA7K_INT_CPU_ON | QCA7K_INT_WRBUF_ERR | QCA7K_INT_RDBUF_ERR | QCA7K_INT_PKT_AVLBL);
+    }
+    void interrupts_enable(uint16_t mask) { interrupts_set(interrupts_get() | mask); }
+    void interrupts_disable_all() { interrupts_set(0x0000); }
+    void interrupts_disable(uint16_t mask) { interrupts_set(interrupts_get() & ~mask); }
+
+    /** See qca7k_interrupt_reasons */
+    uint16_t interrupt_reasons()
+    {
+        interrupts_disable_all();
+        uint16_t reasons = read_register(QCA7K_REG_INTR_CAUSE);
+        write_register(QCA7K_REG_INTR_CAUSE, reasons);
+        return reasons;
+    }
+
+    /** See qca7k_startup */
+    qca7k_state_t startup()
+    {
+        (void)signature();
+        if (signature() != QCA7K_SIGNATURE)
+            return QCA7K_BAD_SIGNATURE;
+
+        interrupts_enable_all();
+        return QCA7K_OK;
+    }
+
+    /** See qca7k_reset */
+    void reset()
+    {
+        write_register(QCA7K_REG_SPI_CONFIG, read_register(QCA7K_REG_SPI_CONFIG) | QCA7K_SLAVE_RESET_BIT);
+    }
+
+    /** Send a frame
+     * @param frame frame to transmit
+     * @return      QCA7K_OK on success, error code otherwise
+     */
+    qca7k_state_t send(span<const uint8_t> frame)
+    {
+        if (frame.size() > QCA7K_FRAME_MAX)
+            return QCA7K_FRAME_OVERFLOW;
+
+        size_t size_to_write = frame.size() < QCA7K_FRAME_MIN ? QCA7K_FRAME_MIN : frame.size();
+        size_t size_needed = 4 + 2 + 2 + size_to_write + 2;
+        if (read_register(QCA7K_REG_WRBUF_SPC_AVA) < size_needed)
+            return QCA7K_WRITE_BUFFER_INSUFFICIENT;
+        write_register(QCA7K_REG_BFR_SIZE, (uint16_t)size_needed);
+
+        transaction<Transport> tr(_t);
+        _t.write16(command(false, false, 0x0000));
+
+        /* Start of Frame, frame length (little endian) and reserved */
+        _t.write16((uint16_t)QCA7K_SOF << 8 | QCA7K_SOF);
+        _t.write16((uint16_t)QCA7K_SOF << 8 | QCA7K_SOF);
+        _t.write16((uint16_t)(size_to_write << 8 | ((size_to_write >> 8) & 0xFF)));
+        _t.write16((uint16_t)QCA7K_RESERVED << 8 | QCA7K_RESERVED);
+
+        _t.write_block(frame.data(), frame.size());
+        for (size_t i = frame.size(); i < size_to_write; i++)
+            _t.write(0x00);
+
+        _t.write16((uint16_t)QCA7K_EOF << 8 | QCA7K_EOF);
+        return QCA7K_OK;
+    }
+
+    /** Receive a frame
+     * Same as qca7k_recv, but the state lives in the object and the frame length is reported
+     * Frames longer than the buffer are dropped
+     * @param buffer    storage for the frame, keep passing the same one until the frame is complete
+     * @param size      set to the frame length once it is complete
+     * @return          QCA7K_OK if full frame is received, error or state code otherwise
+     */
+    qca7k_state_t recv(span<uint8_t> buffer, size_t& size)
+    {
+        if (!buffer.data())
+            return QCA7K_NULL_RECV_BUFFER;
+        if (buffer.data() != _rx.origin || _rx.state == QCA7K_OK || _rx.state == QCA7K_INTERNAL_ERROR)
+            reset_state_machine(buffer);
+
+        uint16_t bytes_available = read_register(QCA7K_REG_RDBUF_BYTE_AVA);
+        if (!bytes_available)
+            return QCA7K_EMPTY_READ_BUFFER;
+
+        transaction<Transport> tr(_t);
+        _t.write16(command(true, false, 0x0000));
+        for (size_t i = 0; i < bytes_available; i++)
+        {
+            if (recv_byte(_t.read()) == QCA7K_OK)
+            {
+                size = _rx.fl;
+                break;
+            }
+        }
+        return _rx.state;
+    }
+
+private:
+    /** Receive state machine, mirrors the one of libqca7k.c */
+    struct
+    {
+        qca7k_state_t state = QCA7K_READING_SOF;
+        uint8_t* origin = nullptr;
+        size_t capacity = 0;
+        size_t received = 0;
+        size_t left = 4;
+        uint8_t expected = QCA7K_SOF;
+        uint16_t fl = 0;
+    } _rx;
+
+    Transport _t;
+
+    void reset_state_machine(span<uint8_t> buffer)
+    {
+        _rx.origin = buffer.data();
+        _rx.capacity = buffer.size();
+        _rx.received = 0;
+        _rx.left = 4;
+        _rx.expected = QCA7K_SOF;
+        _rx.state = QCA7K_READING_SOF;
+        _rx.fl = 0;
+    }
+
+    void reset_state_machine() { reset_state_machine(span<uint8_t>(_rx.origin, _rx.capacity)); }
+
+    inline qca7k_state_t recv_byte(uint8_t v)
+    {
+        switch (_rx.state)
+        {
+            case QCA7K_READING_SOF:
+            case QCA7K_READING_RESERVED:
+            case QCA7K_READING_EOF:
+                if (_rx.expected != v)
+                {
+                    bool retry = _rx.state != QCA7K_READING_SOF;
+                    reset_state_machine();
+                    return retry ? recv_byte(v) : _rx.state;
+                }
+                break;
+
+            case QCA7K_READING_FL:
+                _rx.fl |= ((uint16_t)v) << (8 * (2 - _rx.left));
+                break;
+
+            case QCA7K_READING_FRAME:
+                _rx.origin[_rx.received++] = v;
+                break;
+
+            default:
+                reset_state_machine();
+                return _rx.state = QCA7K_INTERNAL_ERROR;
+        }
+
+        if (--_rx.left)
+            return _rx.state;
+
+        switch (_rx.state)
+        {
+            case QCA7K_READING_SOF:
+                _rx.state = QCA7K_READING_FL;
+                _rx.left = 2;
+                break;
+
+            case QCA7K_READING_FL:
+                /* The buffer size is known here, so a frame that does not fit is not even started */
+                if (_rx.fl < QCA7K_FRAME_MIN || _rx.fl > _rx.capacity || _rx.fl > QCA7K_FRAME_MAX)
+                {
+                    reset_state_machine();
+                    break;
+                }
+                _rx.state = QCA7K_READING_RESERVED;
+                _rx.left = 2;
+                _rx.expected = QCA7K_RESERVED;
+                break;
+
+            case QCA7K_READING_RESERVED:
+                _rx.state = QCA7K_READING_FRAME;
+                _rx.left = _rx.fl;
+                break;
+
+            case QCA7K_READING_FRAME:
+                _rx.state = QCA7K_READING_EOF;
+                _rx.left = 2;
+                _rx.expected = QCA7K_EOF;
+                break;
+
+            case QCA7K_READING_EOF:
+            {
+                uint16_t fl = _rx.fl;
+                reset_state_machine();
+                _rx.fl = fl;
+                _rx.state = QCA7K_OK;
+                break;
+            }
+
+            default:
+                break;
+        }
+        return _rx.state;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,222 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+
+
+#include "libqca7k_atten.h"
+
+#if defined(QCA7K_ATTEN_SSE2)
+#include <emmintrin.h>
+#elif defined(QCA7K_ATTEN_NEON)
+#include <arm_neon.h>
+#endif
+
+void qca7k_atten_accumulate_ref(uint16_t* sum, const uint8_t* aag, size_t groups)
+{
+    for (size_t i = 0; i < groups; i++)
+        sum[i] = (uint16_t)(sum[i] + aag[i]);
+}
+
+void qca7k_atten_average_ref(uint8_t* aag, const uint16_t* sum, size_t groups, uint8_t sounds)
+{
+    if (!sounds)
+        return;
+    for (size_t i = 0; i < groups; i++)
+        aag[i] = (uint8_t)((sum[i] + sounds / 2) / sounds);
+}
+
+uint8_t qca7k_atten_mean_ref(const uint8_t* aag, size_t groups)
+{
+    if (!groups)
+        return 0xFF;
+
+    uint32_t sum = 0;
+    for (size_t i = 0; i < groups; i++)
+        sum += aag[i];
+    return (uint8_t)((sum + groups / 2) / groups);
+}
+
+#if defined(QCA7K_ATTEN_SSE2) || defined(QCA7K_ATTEN_NEON)
+/* Division by the sounds without a divide instruction (Granlund and Montgomery):
+ * x / d = (t + ((x - t) >> 1)) >> (l - 1) with t = (x * m) >> 16, l = ceil(log2(d)) and
+ * m = 2^16 * (2^l - d) / d + 1, exact for any 16 bit x and 2 <= d < 2^16
+ */
+struct qca7k_atten_div
+{
+    uint16_t m;
+    uint8_t shift;
+};
+
+static struct qca7k_atten_div qca7k_atten_divisor(uint8_t d)
+{
+    uint8_t l = 1;
+    while ((1u << l) < d)
+        l++;
+    return (struct qca7k_atten_div){ (uint16_t)((((1u << l) - d) << 16) / d + 1), (uint8_t)(l - 1) };
+}
+#endif
+
+#if defined(QCA7K_ATTEN_SSE2)
+void qca7k_atten_accumulate(uint16_t* sum, const uint8_t* aag, size_t groups)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= groups; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(aag + i));
+        __m128i lo = _mm_loadu_si128((const __m128i*)(sum + i));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(sum + i + 8));
+        _mm_storeu_si128((__m128i*)(sum + i), _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero)));
+        _mm_storeu_si128((__m128i*)(sum + i + 8), _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero)));
+    }
+    if (i + 8 <= groups)
+    {
+        __m128i v = _mm_loadl_epi64((const __m128i*)(aag + i));
+        _mm_storeu_si128((__m128i*)(sum + i), _mm_add_epi16(_mm_loadu_si128((const __m128i*)(sum + i)), _mm_unpacklo_epi8(v, zero)));
+        i += 8;
+    }
+    qca7k_atten_accumulate_ref(sum + i, aag + i, groups - i);
+}
+
+void qca7k_atten_average(uint8_t* aag, const uint16_t* sum, size_t groups, uint8_t sounds)
+{
+    if (sounds < 2)
+    {
+        qca7k_atten_average_ref(aag, sum, groups, sounds);
+        return;
+    }
+
+    struct qca7k_atten_div div = qca7k_atten_divisor(sounds);
+    const __m128i m = _mm_set1_epi16((short)div.m);
+    const __m128i half = _mm_set1_epi16(sounds / 2);
+    const __m128i shift = _mm_cvtsi32_si128(div.shift);
+    size_t i = 0;
+    for (; i + 8 <= groups; i += 8)
+    {
+        __m128i x = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(sum + i)), half);
+        __m128i t = _mm_mulhi_epu16(x, m);
+        __m128i q = _mm_srl_epi16(_mm_add_epi16(t, _mm_srli_epi16(_mm_sub_epi16(x, t), 1)), shift);
+        /* The averages fit in a byte, so the saturating pack does not change them */
+        _mm_storel_epi64((__m128i*)(aag + i), _mm_packus_epi16(q, q));
+    }
+    qca7k_atten_average_ref(aag + i, sum + i, groups - i, sounds);
+}
+
+uint8_t qca7k_atten_mean(const uint8_t* aag, size_t groups)
+{
+    if (!groups)
+        return 0xFF;
+
+    /* Sums of absolute differences against zero add up 8 bytes into each half */
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    size_t i = 0;
+    for (; i + 16 <= groups; i += 16)
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(aag + i)), zero));
+    if (i + 8 <= groups)
+    {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadl_epi64((const __m128i*)(aag + i)), zero));
+        i += 8;
+    }
+    uint32_t sum = (uint32_t)_mm_cvtsi128_si32(acc) + (uint32_t)_mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc));
+    for (; i < groups; i++)
+        sum += aag[i];
+    return (uint8_t)((sum + groups / 2) / groups);
+}
+#elif defined(QCA7K_ATTEN_NEON)
+void qca7k_atten_accumulate(uint16_t* sum, const uint8_t* aag, size_t groups)
+{
+    size_t i = 0;
+    for (; i + 16 <= groups; i += 16)
+    {
+        uint8x16_t v = vld1q_u8(aag + i);
+        vst1q_u16(sum + i, vaddw_u8(vld1q_u16(sum + i), vget_low_u8(v)));
+        vst1q_u16(sum + i + 8, vaddw_u8(vld1q_u16(sum + i + 8), vget_high_u8(v)));
+    }
+    if (i + 8 <= groups)
+    {
+        vst1q_u16(sum + i, vaddw_u8(vld1q_u16(sum + i), vld1_u8(aag + i)));
+        i += 8;
+    }
+    qca7k_atten_accumulate_ref(sum + i, aag + i, groups - i);
+}
+
+void qca7k_atten_average(uint8_t* aag, const uint16_t* sum, size_t groups, uint8_t sounds)
+{
+    if (sounds < 2)
+    {
+        qca7k_atten_average_ref(aag, sum, groups, sounds);
+        return;
+    }
+
+    struct qca7k_atten_div div = qca7k_atten_divisor(sounds);
+    const uint16x4_t m = vdup_n_u16(div.m);
+    const uint16x8_t half = vdupq_n_u16(sounds / 2);
+    const int16x8_t shift = vdupq_n_s16((int16_t)-div.shift);
+    size_t i = 0;
+    for (; i + 8 <= groups; i += 8)
+    {
+        uint16x8_t x = vaddq_u16(vld1q_u16(sum + i), half);
+        uint16x8_t t = vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(x), m), 16), vshrn_n_u32(vmull_u16(vget_high_u16(x), m), 16));
+        uint16x8_t q = vshlq_u16(vaddq_u16(t, vshrq_n_u16(vsubq_u16(x, t), 1)), shift);
+        vst1_u8(aag + i, vmovn_u16(q));
+    }
+    qca7k_atten_average_ref(aag + i, sum + i, groups - i, sounds);
+}
+
+uint8_t qca7k_atten_mean(const uint8_t* aag, size_t groups)
+{
+    if (!groups)
+        return 0xFF;
+
+    /* Pairwise widening adds, a lane takes 2 bytes per round */
+    uint32x4_t acc = vdupq_n_u32(0);
+    size_t i = 0;
+    for (; i + 16 <= groups; i += 16)
+        acc = vpadalq_u16(acc, vpaddlq_u8(vld1q_u8(aag + i)));
+    if (i + 8 <= groups)
+    {
+        acc = vaddw_u16(acc, vpaddl_u8(vld1_u8(aag + i)));
+        i += 8;
+    }
+    uint64x2_t pairs = vpaddlq_u32(acc);
+    uint32_t sum = (uint32_t)(vgetq_lane_u64(pairs, 0) + vgetq_lane_u64(pairs, 1));
+    for (; i < groups; i++)
+        sum += aag[i];
+    return (uint8_t)((sum + groups / 2) / groups);
+}
+#else
+void qca7k_atten_accumulate(uint16_t* sum, const uint8_t* aag, size_t groups)
+{
+    qca7k_atten_accumulate_ref(sum, aag, groups);
+}
+
+void qca7k_atten_average(uint8_t* aag, const uint16_t* sum, size_t groups, uint8_t sounds)
+{
+    qca7k_atten_average_ref(aag, sum, groups, sounds);
+}
+
+uint8_t qca7k_atten_mean(const uint8_t* aag, size_t groups)
+{
+    return qca7k_atten_mean_ref(aag, groups);
+}
+#endif
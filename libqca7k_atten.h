@@ -0,0 +1,82 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+
+/* Attenuation profile kernels
+ * Sum up the attenuation profiles of the sounds straight from the received frames and average them, for
+ * CM_ATTEN_CHAR. Uses SSE2 when the compiler targets it and plain C otherwise. The plain C reference of each
+ * kernel is always there, the vector ones give the same result bit for bit, rounding included, which
+ * libqca7k_atten_check.c verifies.
+ * NOTE: does not need libqca7k.c
+ */
+
+#ifndef LIBQCA7K_ATTEN_H
+#define LIBQCA7K_ATTEN_H
+
+#include "libqca7k.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Set QCA7K_NO_SIMD to always use the plain C kernels
+ * NOTE: the NEON kernels have not been built with an ARM compiler yet, so they are only used with
+ * QCA7K_ATTEN_USE_NEON, run libqca7k_atten_check.c on the target before setting it
+ */
+#if !defined(QCA7K_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define QCA7K_ATTEN_SSE2
+#elif !defined(QCA7K_NO_SIMD) && defined(QCA7K_ATTEN_USE_NEON) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define QCA7K_ATTEN_NEON
+#endif
+
+/** Add a profile to the sums
+ * @param sum       sums of each group, wraps around like uint16_t does, which takes over 257 sounds
+ * @param aag       attenuation of each group in dB, e.g. right in the received frame
+ * @param groups    number of groups
+ */
+void qca7k_atten_accumulate(uint16_t* sum, const uint8_t* aag, size_t groups);
+
+/** Average the sums over the sounds, rounding to nearest (halves up)
+ * @param aag       average of each group
+ * @param sum       sums of each group, at most 255 per sound as qca7k_atten_accumulate leaves them
+ * @param groups    number of groups
+ * @param sounds    profiles summed up, nothing is written for 0
+ */
+void qca7k_atten_average(uint8_t* aag, const uint16_t* sum, size_t groups, uint8_t sounds);
+
+/** Mean attenuation over the groups of a profile, rounding to nearest (halves up)
+ * @param aag       attenuation of each group
+ * @param groups    number of groups
+ * @return          mean in dB, 255 for no groups
+ */
+uint8_t qca7k_atten_mean(const uint8_t* aag, size_t groups);
+
+/* Plain C references of the kernels above */
+void qca7k_atten_accumulate_ref(uint16_t* sum, const uint8_t* aag, size_t groups);
+void qca7k_atten_average_ref(uint8_t* aag, const uint16_t* sum, size_t groups, uint8_t sounds);
+uint8_t qca7k_atten_mean_ref(const uint8_t* aag, size_t groups);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
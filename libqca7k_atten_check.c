@@ -0,0 +1,146 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+
+/* Bit-exactness check of the attenuation profile kernels against their plain C references
+ * Build and run it for the target with the same flags as the library, e.g.
+ *     cc -O2 -o atten_check libqca7k_atten_check.c libqca7k_atten.c && ./atten_check
+ * Averages are checked for every sound count and every sum the kernels take, accumulation and means
+ * for random profiles of up to QCA7K_CHECK_GROUPS groups at every alignment. Exits with 1 on a mismatch.
+ */
+
+#include "libqca7k_atten.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/** Largest number of groups checked, a bit over what CM_ATTEN_CHAR carries */
+#define QCA7K_CHECK_GROUPS 80
+/** Random runs of each kernel */
+#define QCA7K_CHECK_RUNS 100000
+/** Untouched bytes expected past the groups */
+#define QCA7K_CHECK_GUARD 16
+
+static uint32_t _g_seed = 0x2F6B1A37;
+static unsigned long _g_mismatches = 0;
+
+/** Pseudo-random numbers (xorshift32), the same on every run */
+static uint32_t qca7k_check_random()
+{
+    _g_seed ^= _g_seed << 13;
+    _g_seed ^= _g_seed >> 17;
+    _g_seed ^= _g_seed << 5;
+    return _g_seed;
+}
+
+/** Count and report a mismatch, the first few only */
+static void qca7k_check_fail(const char* kernel, size_t groups, unsigned param)
+{
+    if (_g_mismatches++ < 10)
+        printf("%s mismatch: %zu groups, %u\n", kernel, groups, param);
+}
+
+/** Every sum up to 255 per sound for every sound count, in runs of every length and alignment */
+static void qca7k_check_average()
+{
+    static uint16_t sum[QCA7K_CHECK_GROUPS + 8];
+    static uint8_t aag[QCA7K_CHECK_GROUPS + 8 + QCA7K_CHECK_GUARD], ref[QCA7K_CHECK_GROUPS + 8 + QCA7K_CHECK_GUARD];
+
+    for (unsigned sounds = 0; sounds < 256; sounds++)
+    {
+        uint32_t max = sounds ? 255 * sounds : 255;
+        uint32_t next = 0;
+        for (size_t run = 0; next <= max; run++)
+        {
+            size_t groups = run % (QCA7K_CHECK_GROUPS + 1);
+            size_t offset = run / (QCA7K_CHECK_GROUPS + 1) % 8;
+            /* The last run is topped up with the largest sum */
+            for (size_t i = 0; i < groups; i++)
+                sum[offset + i] = (uint16_t)(next <= max ? next++ : max);
+
+            memset(aag, 0xA5, sizeof(aag));
+            memset(ref, 0xA5, sizeof(ref));
+            qca7k_atten_average(aag + offset, sum + offset, groups, (uint8_t)sounds);
+            qca7k_atten_average_ref(ref + offset, sum + offset, groups, (uint8_t)sounds);
+            if (memcmp(aag, ref, sizeof(aag)))
+                qca7k_check_fail("average", groups, sounds);
+        }
+    }
+}
+
+/** Random profiles onto random sums, wrapping around included */
+static void qca7k_check_accumulate()
+{
+    static uint8_t aag[QCA7K_CHECK_GROUPS + 16];
+    static uint16_t sum[QCA7K_CHECK_GROUPS + 16 + QCA7K_CHECK_GUARD], ref[QCA7K_CHECK_GROUPS + 16 + QCA7K_CHECK_GUARD];
+
+    for (size_t run = 0; run < QCA7K_CHECK_RUNS; run++)
+    {
+        size_t groups = run % (QCA7K_CHECK_GROUPS + 1);
+        size_t offset = run / (QCA7K_CHECK_GROUPS + 1) % 16;
+        for (size_t i = 0; i < sizeof(aag); i++)
+            aag[i] = (uint8_t)qca7k_check_random();
+        for (size_t i = 0; i < sizeof(sum) / sizeof(sum[0]); i++)
+            sum[i] = ref[i] = (uint16_t)qca7k_check_random();
+
+        qca7k_atten_accumulate(sum + offset, aag + offset, groups);
+        qca7k_atten_accumulate_ref(ref + offset, aag + offset, groups);
+        if (memcmp(sum, ref, sizeof(sum)))
+            qca7k_check_fail("accumulate", groups, (unsigned)offset);
+    }
+}
+
+/** Random profiles, some of them all 255 for the largest sums */
+static void qca7k_check_mean()
+{
+    static uint8_t aag[QCA7K_CHECK_GROUPS + 16];
+
+    for (size_t run = 0; run < QCA7K_CHECK_RUNS; run++)
+    {
+        size_t groups = run % (QCA7K_CHECK_GROUPS + 1);
+        size_t offset = run / (QCA7K_CHECK_GROUPS + 1) % 16;
+        bool full = run % 7 == 0;
+        for (size_t i = 0; i < sizeof(aag); i++)
+            aag[i] = full ? 0xFF : (uint8_t)qca7k_check_random();
+
+        if (qca7k_atten_mean(aag + offset, groups) != qca7k_atten_mean_ref(aag + offset, groups))
+            qca7k_check_fail("mean", groups, (unsigned)offset);
+    }
+}
+
+int main()
+{
+#if defined(QCA7K_ATTEN_SSE2)
+    const char* kernels = "SSE2";
+#elif defined(QCA7K_ATTEN_NEON)
+    const char* kernels = "NEON";
+#else
+    const char* kernels = "plain C";
+#endif
+
+    qca7k_check_average();
+    qca7k_check_accumulate();
+    qca7k_check_mean();
+
+    printf("%s kernels: %lu mismatches\n", kernels, _g_mismatches);
+    return _g_mismatches ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+#include "libqca7k_frame.h"
+
+#include <string.h>
+
+void qca7k_decoder_reset(qca7k_decoder_t* dec)
+{
+    dec->state = QCA7K_READING_SOF;
+    dec->left = 4;
+    dec->expected = QCA7K_SOF;
+    dec->fl = 0;
+    dec->skip = false;
+    dec->held = 0;
+}
+
+void qca7k_decoder_init(qca7k_decoder_t* dec, const qca7k_stream_t* stream)
+{
+    dec->stream = stream;
+    dec->stats = (qca7k_rx_stats_t){ 0 };
+    qca7k_decoder_reset(dec);
+}
+
+void qca7k_decoder_abort(qca7k_decoder_t* dec)
+{
+    bool started = dec->state == QCA7K_READING_FRAME || dec->state == QCA7K_READING_EOF;
+    if (started && !dec->skip && dec->stream->end)
+        dec->stream->end(dec->stream->ctx, dec->state);
+    qca7k_decoder_reset(dec);
+}
+
+bool qca7k_decoder_partial(const qca7k_decoder_t* dec)
+{
+    if (dec->state == QCA7K_OK)
+        return false;
+    return dec->state != QCA7K_READING_SOF || dec->left != 4;
+}
+
+size_t qca7k_decoder_feed(qca7k_decoder_t* dec, const uint8_t* data, size_t size)
+{
+    const qca7k_stream_t* stream = dec->stream;
+    if (dec->state == QCA7K_OK)
+        qca7k_decoder_reset(dec);
+
+    size_t i = 0;
+    while (i < size)
+    {
+        /* Hand over as much of the frame as there is, holding the head back until the consumer had a look */
+        if (dec->state == QCA7K_READING_FRAME)
+        {
+            size_t n = size - i < dec->left ? size - i : dec->left;
+            if (!dec->skip && stream->head && dec->held < QCA7K_FRAME_HEAD_SIZE)
+            {
+                size_t room = QCA7K_FRAME_HEAD_SIZE - dec->held;
+                if (n > room)
+                    n = room;
+                memcpy(dec->head + dec->held, data + i, n);
+                dec->held += n;
+                if (dec->held == QCA7K_FRAME_HEAD_SIZE)
+                {
+                    dec->skip = !stream->head(stream->ctx, dec->head, dec->held);
+                    if (!dec->skip)
+                        stream->chunk(stream->ctx, dec->head, dec->held);
+                }
+            }
+            else if (!dec->skip)
+                stream->chunk(stream->ctx, data + i, n);
+            i += n;
+            dec->left -= n;
+            if (!dec->left)
+            {
+                dec->state = QCA7K_READING_EOF;
+                dec->left = 2;
+                dec->expected = QCA7K_EOF;
+            }
+            continue;
+        }
+
+        uint8_t v = data[i];
+        switch (dec->state)
+        {
+            /* In 3 modes we are waiting for the same characters to pop up and just counting */
+            case QCA7K_READING_SOF:
+            case QCA7K_READING_RESERVED:
+            case QCA7K_READING_EOF:
+                if (dec->expected != v)
+                {
+                    /* Re-trying the same byte as a Start of Frame if it wasn't SOF mode */
+                    if (dec->state != QCA7K_READING_SOF)
+                        dec->stats.bad_framing++;
+                    else
+                        i++;
+                    qca7k_decoder_abort(dec);
+                    continue;
+                }
+                break;
+
+            /* In FL mode, compose the value
+             * NOTE: Little Endian */
+            case QCA7K_READING_FL:
+                dec->fl |= ((uint16_t)v) << (8 * (2 - dec->left));
+                break;
+
+            /* This should never happen, but if it does, let's start over */
+            default:
+                qca7k_decoder_reset(dec);
+                continue;
+        }
+
+        /* If we made this far, the byte was accepted, check if we are at the end of the stage */
+        i++;
+        if (--dec->left)
+            continue;
+
+        switch (dec->state)
+        {
+            case QCA7K_READING_SOF:
+                dec->state = QCA7K_READING_FL;
+                dec->left = 2;
+                break;
+
+            case QCA7K_READING_FL:
+                /* A corrupted length would overrun the buffer or swallow the following frames, resync right away */
+                if (dec->fl < QCA7K_FRAME_MIN || dec->fl > QCA7K_FRAME_MAX)
+                {
+                    dec->stats.bad_length++;
+                    qca7k_decoder_reset(dec);
+                    break;
+                }
+                dec->state = QCA7K_READING_RESERVED;
+                dec->left = 2;
+                dec->expected = QCA7K_RESERVED;
+                break;
+
+            case QCA7K_READING_RESERVED:
+                dec->state = QCA7K_READING_FRAME;
+                dec->left = dec->fl;
+                dec->skip = stream->start && !stream->start(stream->ctx, dec->fl);
+                break;
+
+            case QCA7K_READING_EOF:
+                if (!dec->skip && stream->end)
+                    stream->end(stream->ctx, QCA7K_OK);
+                dec->state = QCA7K_OK;
+                dec->left = 4;
+                return i;
+
+            /* Will not happen but let's keep the compiler happy */
+            default:
+                break;
+        }
+    }
+    return i;
+}
+
+size_t qca7k_decoder_feed_all(qca7k_decoder_t* dec, const uint8_t* data, size_t size)
+{
+    size_t frames = 0;
+    for (size_t i = 0; i < size;)
+    {
+        i += qca7k_decoder_feed(dec, data + i, size - i);
+        if (dec->state == QCA7K_OK)
+            frames++;
+    }
+    return frames;
+}
+
+size_t qca7k_encode_header(uint8_t* buf, size_t size)
+{
+    size_t fl = size < QCA7K_FRAME_MIN ? QCA7K_FRAME_MIN : size;
+    buf[0] = buf[1] = buf[2] = buf[3] = QCA7K_SOF;
+    buf[4] = (uint8_t)fl;
+    buf[5] = (uint8_t)(fl >> 8);
+    buf[6] = buf[7] = QCA7K_RESERVED;
+    return fl;
+}
+
+size_t qca7k_encode_trailer(uint8_t* buf, size_t size)
+{
+    size_t n = 0;
+    for (; size + n < QCA7K_FRAME_MIN; n++)
+        buf[n] = 0x00;
+    buf[n++] = QCA7K_EOF;
+    buf[n++] = QCA7K_EOF;
+    return n;
+}
@@ -0,0 +1,117 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+/* Framing engine
+ * The SOF, FL, reserved, frame, EOF framing the QCA7000 uses on both the SPI and the UART host interface,
+ * without any I/O: the encoder fills in headers and trailers, the decoder takes bytes in chunks of any size
+ * and hands frames over to qca7k_stream_t callbacks in runs, never byte by byte
+ */
+
+#ifndef LIBQCA7K_FRAME_H
+#define LIBQCA7K_FRAME_H
+
+#include "libqca7k.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Bytes the framing adds to a frame: SOF, FL, reserved and EOF (padding not included) */
+#define QCA7K_FRAME_OVERHEAD 10
+
+/* Frame decoder, one per byte stream, treat as opaque */
+typedef struct
+{
+    /** Callbacks the frames go to */
+    const qca7k_stream_t* stream;
+    /** State, QCA7K_OK right after a frame is complete */
+    qca7k_state_t state;
+    /** How many bytes are left to read in current state */
+    size_t left;
+    /** What is the byte we are expecting */
+    uint8_t expected;
+    /** Frame length */
+    uint16_t fl;
+    /** Whether the consumer declined the current frame */
+    bool skip;
+    /** Start of the frame held back for the head callback */
+    uint8_t head[QCA7K_FRAME_HEAD_SIZE];
+    uint8_t held;
+    /** Resyncs so far, timeouts are up to the caller */
+    qca7k_rx_stats_t stats;
+} qca7k_decoder_t;
+
+/** Static initializer for a decoder */
+#define QCA7K_DECODER_INIT(stream) { (stream), QCA7K_READING_SOF, 4, QCA7K_SOF, 0, false, { 0 }, 0, { 0, 0, 0, 0 } }
+
+/** Set up a decoder
+ * @param dec       decoder
+ * @param stream    callbacks, chunk is mandatory
+ */
+void qca7k_decoder_init(qca7k_decoder_t* dec, const qca7k_stream_t* stream);
+
+/** Parse bytes, stopping right after a frame is complete so the caller can deal with it first
+ * A frame may span any number of calls, nothing is kept but the state
+ * @param dec   decoder
+ * @param data  bytes as they came in
+ * @param size  number of bytes
+ * @return      number of bytes consumed, less than size only if a frame was completed (state is QCA7K_OK then)
+ */
+size_t qca7k_decoder_feed(qca7k_decoder_t* dec, const uint8_t* data, size_t size);
+
+/** Parse all the bytes
+ * @param dec   decoder
+ * @param data  bytes as they came in
+ * @param size  number of bytes
+ * @return      number of frames completed
+ */
+size_t qca7k_decoder_feed_all(qca7k_decoder_t* dec, const uint8_t* data, size_t size);
+
+/** Go back to waiting for SOF, dropping the frame in progress without telling anybody */
+void qca7k_decoder_reset(qca7k_decoder_t* dec);
+
+/** Give up on the frame in progress, the end callback gets the state it was at if the frame was started */
+void qca7k_decoder_abort(qca7k_decoder_t* dec);
+
+/** Check if part of a frame has been parsed */
+bool qca7k_decoder_partial(const qca7k_decoder_t* dec);
+
+/** Put the frame header (SOF, FL, reserved) into 8 bytes of the buffer
+ * NOTE: frame length is little endian, unlike the registers
+ * @param buf   storage for 8 bytes
+ * @param size  frame length
+ * @return      frame length with padding to the minimum size
+ */
+size_t qca7k_encode_header(uint8_t* buf, size_t size);
+
+/** Put the padding and End of Frame into the buffer
+ * @param buf   storage right after the frame data, at most QCA7K_FRAME_MIN + 2 bytes are used
+ * @param size  frame length
+ * @return      number of bytes put
+ */
+size_t qca7k_encode_trailer(uint8_t* buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,247 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+
+#include "libqca7k_health.h"
+
+#include <string.h>
+
+/** Health state of a device */
+struct qca7k_health_device
+{
+    /** Frames sent and not seen sent by the chip, a ring of references */
+    qca7k_frame_t* inflight[QCA7K_HEALTH_INFLIGHT];
+    size_t head;
+    size_t count;
+    /** Kept frames before this one are in the chip, the rest wait for the replay */
+    size_t replay;
+    /** Action the next receive error gets */
+    qca7k_health_action_t level;
+    /** Something went wrong since the last spot check */
+    bool dirty;
+    qca7k_health_stats_t stats;
+};
+
+static struct qca7k_health_device _g_health[QCA7K_DEVICES];
+
+static inline struct qca7k_health_device* qca7k_health_dev()
+{
+    return &_g_health[qca7k_selected()];
+}
+
+static inline qca7k_frame_t* qca7k_health_at(struct qca7k_health_device* h, size_t i)
+{
+    return h->inflight[(h->head + i) % QCA7K_HEALTH_INFLIGHT];
+}
+
+/** Let go of every kept frame */
+static void qca7k_health_release(struct qca7k_health_device* h)
+{
+    for (; h->count; h->count--, h->head = (h->head + 1) % QCA7K_HEALTH_INFLIGHT)
+        qca7k_frame_unref(h->inflight[h->head]);
+    h->head = 0;
+    h->replay = 0;
+}
+
+/** Send the kept frames again as far as the write buffer allows
+ * @return      true if nothing is left to replay
+ */
+static bool qca7k_health_replay(struct qca7k_health_device* h)
+{
+    for (; h->replay < h->count; h->replay++)
+    {
+        if (qca7k_send_frame(qca7k_health_at(h, h->replay)) != QCA7K_OK)
+            return false;
+        h->stats.replayed++;
+    }
+    return true;
+}
+
+/** The chip lost what it had, everything kept goes again */
+static void qca7k_health_lost(struct qca7k_health_device* h)
+{
+    h->replay = 0;
+    h->level = QCA7K_HEALTH_RESYNC;
+    h->dirty = false;
+}
+
+/** Reset the chip, the replay starts once it is up again */
+static qca7k_health_action_t qca7k_health_reset(struct qca7k_health_device* h)
+{
+    h->stats.resets++;
+    qca7k_health_lost(h);
+    qca7k_boot_start();
+    return QCA7K_HEALTH_RESET;
+}
+
+/** Fix a receive error, one step heavier than the last time unless a spot check passed in between */
+static qca7k_health_action_t qca7k_health_escalate(struct qca7k_health_device* h)
+{
+    if (h->level < QCA7K_HEALTH_RESYNC)
+        h->level = QCA7K_HEALTH_RESYNC;
+    h->dirty = true;
+
+    switch (h->level)
+    {
+        case QCA7K_HEALTH_RESYNC:
+            h->stats.resyncs++;
+            qca7k_recv_resync();
+            h->level = QCA7K_HEALTH_FLUSH;
+            return QCA7K_HEALTH_RESYNC;
+
+        case QCA7K_HEALTH_FLUSH:
+            h->stats.flushes++;
+            (void)qca7k_recv_flush();
+            h->level = QCA7K_HEALTH_RESET;
+            return QCA7K_HEALTH_FLUSH;
+
+        default:
+            return qca7k_health_reset(h);
+    }
+}
+
+/** Move on once a bring-up is over: replay if it came up */
+static void qca7k_health_booted(struct qca7k_health_device* h, qca7k_boot_state_t state)
+{
+    if (state == QCA7K_BOOT_READY)
+        (void)qca7k_health_replay(h);
+}
+
+qca7k_health_action_t qca7k_health_event(uint16_t reasons)
+{
+    struct qca7k_health_device* h = qca7k_health_dev();
+    qca7k_boot_info_t boot;
+    qca7k_boot_info(&boot);
+
+    if (boot.state == QCA7K_BOOT_WAITING)
+    {
+        qca7k_health_booted(h, qca7k_boot_event(reasons));
+        return QCA7K_HEALTH_NONE;
+    }
+
+    /* CPU_ON with nobody waiting for it, the chip came back by itself with empty buffers */
+    if (reasons & QCA7K_INT_CPU_ON)
+    {
+        h->stats.restarts++;
+        qca7k_health_lost(h);
+        qca7k_recv_resync();
+        if (qca7k_startup() != QCA7K_OK)
+            return qca7k_health_reset(h);
+        (void)qca7k_health_replay(h);
+        return QCA7K_HEALTH_RESTARTED;
+    }
+
+    /* The write buffer cannot be flushed from here and whatever was being written is lost, so straight to a reset */
+    if (reasons & QCA7K_INT_WRBUF_ERR)
+    {
+        h->stats.wrbuf_errors++;
+        return qca7k_health_reset(h);
+    }
+
+    if (reasons & QCA7K_INT_RDBUF_ERR)
+    {
+        h->stats.rdbuf_errors++;
+        return qca7k_health_escalate(h);
+    }
+
+    return QCA7K_HEALTH_NONE;
+}
+
+qca7k_health_action_t qca7k_health_check()
+{
+    struct qca7k_health_device* h = qca7k_health_dev();
+    qca7k_boot_info_t boot;
+    qca7k_boot_info(&boot);
+
+    if (boot.state == QCA7K_BOOT_WAITING)
+    {
+        qca7k_health_booted(h, qca7k_boot_poll());
+        return QCA7K_HEALTH_NONE;
+    }
+
+    qca7k_txn_t txn;
+    qca7k_txn_init(&txn);
+    uint16_t signature = 0, space = 0;
+    qca7k_txn_read(&txn, QCA7K_REG_SIGNATURE, &signature);
+    qca7k_txn_read(&txn, QCA7K_REG_WRBUF_SPC_AVA, &space);
+    qca7k_txn_submit(&txn);
+
+    /* A single bad read may be a glitch on the bus, same as at startup the second one counts */
+    if (signature != QCA7K_SIGNATURE && qca7k_signature() != QCA7K_SIGNATURE)
+    {
+        h->stats.bad_signatures++;
+        return qca7k_health_reset(h);
+    }
+
+    /* Empty write buffer, everything kept has been sent unless a replay is still due */
+    if (space == QCA7K_WRBUF_SIZE && h->replay == h->count)
+        qca7k_health_release(h);
+
+    if (!h->dirty)
+        h->level = QCA7K_HEALTH_RESYNC;
+    h->dirty = false;
+
+    (void)qca7k_health_replay(h);
+    return QCA7K_HEALTH_NONE;
+}
+
+qca7k_state_t qca7k_health_send(qca7k_frame_t* frame)
+{
+    if (!frame)
+        return QCA7K_INVALID_ARGUMENT;
+
+    /* New frames go after the replayed ones to keep the order */
+    struct qca7k_health_device* h = qca7k_health_dev();
+    qca7k_boot_info_t boot;
+    qca7k_boot_info(&boot);
+    if (boot.state == QCA7K_BOOT_WAITING || !qca7k_health_replay(h))
+        return QCA7K_WRITE_BUFFER_INSUFFICIENT;
+
+    qca7k_state_t res = qca7k_send_frame(frame);
+    if (res != QCA7K_OK)
+        return res;
+
+    if (h->count == QCA7K_HEALTH_INFLIGHT)
+    {
+        qca7k_frame_unref(h->inflight[h->head]);
+        h->head = (h->head + 1) % QCA7K_HEALTH_INFLIGHT;
+        h->count--;
+        h->replay--;
+        h->stats.evicted++;
+    }
+    h->inflight[(h->head + h->count++) % QCA7K_HEALTH_INFLIGHT] = qca7k_frame_ref(frame);
+    h->replay++;
+    return QCA7K_OK;
+}
+
+void qca7k_health_stats(qca7k_health_stats_t* stats)
+{
+    if (stats)
+        *stats = qca7k_health_dev()->stats;
+}
+
+void qca7k_health_clear()
+{
+    struct qca7k_health_device* h = qca7k_health_dev();
+    qca7k_health_release(h);
+    memset(h, 0, sizeof(*h));
+}
@@ -0,0 +1,112 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+/* Health monitor
+ * Watches the error interrupts and checks the signature now and then, and applies the lightest fix first:
+ * a receive error resyncs the parser, a second one in a row flushes the read buffer, a third one resets the chip.
+ * A clean check in between starts over from the resync. Frames sent through qca7k_health_send are kept until
+ * the chip is seen to have sent them, and are sent again once it is back after a reset or a restart.
+ * NOTE: bring devices up with qca7k_boot_start, otherwise the first CPU_ON is taken for a restart
+ * NOTE: a replayed frame may have been sent already before the reset, so it can go out twice
+ */
+
+#ifndef LIBQCA7K_HEALTH_H
+#define LIBQCA7K_HEALTH_H
+
+#include "libqca7k.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef QCA7K_HEALTH_INFLIGHT
+/** Frames kept per device for replay, the oldest one is let go to make room */
+#define QCA7K_HEALTH_INFLIGHT 8
+#endif
+
+/* Recovery actions, from the lightest one */
+typedef enum
+{
+    /** Nothing needed */
+    QCA7K_HEALTH_NONE = 0,
+    /** Partial frame dropped, see qca7k_recv_resync */
+    QCA7K_HEALTH_RESYNC,
+    /** Read buffer dropped, see qca7k_recv_flush */
+    QCA7K_HEALTH_FLUSH,
+    /** Chip reset, the transmit is replayed once it is up */
+    QCA7K_HEALTH_RESET,
+    /** Chip restarted by itself, startup redone and the transmit replayed */
+    QCA7K_HEALTH_RESTARTED,
+} qca7k_health_action_t;
+
+/* Per device counters */
+typedef struct
+{
+    uint32_t rdbuf_errors;
+    uint32_t wrbuf_errors;
+    /** CPU_ON outside of a bring-up */
+    uint32_t restarts;
+    /** Spot checks that failed twice in a row */
+    uint32_t bad_signatures;
+    uint32_t resyncs;
+    uint32_t flushes;
+    uint32_t resets;
+    /** Frames sent again after a reset or a restart */
+    uint32_t replayed;
+    /** Frames let go before the chip was seen to send them, they are not replayed */
+    uint32_t evicted;
+} qca7k_health_stats_t;
+
+/** Handle interrupt reasons of the selected device
+ * Also finishes a bring-up in progress and starts the replay once the device is ready
+ * @param reasons   mask from qca7k_interrupt_reasons
+ * @return          action taken
+ */
+qca7k_health_action_t qca7k_health_event(uint16_t reasons);
+
+/** Spot check the selected device, call it periodically
+ * Reads the signature and the write buffer space in one go, lets go of the frames the chip has sent,
+ * continues a replay and polls a bring-up in progress
+ * @return          action taken
+ */
+qca7k_health_action_t qca7k_health_check();
+
+/** Send a frame and keep it for replay
+ * Same as qca7k_send_frame, a reference is held until the chip is seen to have sent it
+ * @param frame     frame to send, the caller keeps its reference
+ * @return          QCA7K_OK on success, QCA7K_WRITE_BUFFER_INSUFFICIENT also while recovering or replaying
+ */
+qca7k_state_t qca7k_health_send(qca7k_frame_t* frame);
+
+/** Get the counters of the selected device
+ * @param stats     pointer to store the counters
+ */
+void qca7k_health_stats(qca7k_health_stats_t* stats);
+
+/** Let go of the kept frames and the counters of the selected device, e.g. when taking it down */
+void qca7k_health_clear();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
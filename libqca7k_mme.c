@@ -0,0 +1,484 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+
+#include "libqca7k_mme.h"
+
+#include <string.h>
+
+void qca7k_mme_put(qca7k_mme_writer_t* w, const uint8_t* data, size_t size)
+{
+    if (w->overflow || size > w->cap - w->size)
+    {
+        w->overflow = true;
+        return;
+    }
+
+    if (data)
+        memcpy(w->buf + w->size, data, size);
+    else
+        memset(w->buf + w->size, 0, size);
+    w->size += size;
+}
+
+void qca7k_mme_put_u8(qca7k_mme_writer_t* w, uint8_t v)
+{
+    qca7k_mme_put(w, &v, 1);
+}
+
+void qca7k_mme_put_u16(qca7k_mme_writer_t* w, uint16_t v)
+{
+    uint8_t bytes[2] = { (uint8_t)v, (uint8_t)(v >> 8) };
+    qca7k_mme_put(w, bytes, 2);
+}
+
+static void qca7k_mme_put_u32(qca7k_mme_writer_t* w, uint32_t v)
+{
+    uint8_t bytes[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+    qca7k_mme_put(w, bytes, 4);
+}
+
+void qca7k_mme_start(qca7k_mme_writer_t* w, uint8_t* buf, size_t cap, const qca7k_mme_hdr_t* hdr)
+{
+    w->buf = buf;
+    w->cap = cap < QCA7K_FRAME_MAX ? cap : QCA7K_FRAME_MAX;
+    w->size = 0;
+    w->overflow = false;
+
+    qca7k_mme_put(w, hdr->dst, QCA7K_MAC_LEN);
+    qca7k_mme_put(w, hdr->src, QCA7K_MAC_LEN);
+    qca7k_mme_put_u8(w, (uint8_t)(QCA7K_ETHERTYPE_HOMEPLUG >> 8));
+    qca7k_mme_put_u8(w, (uint8_t)QCA7K_ETHERTYPE_HOMEPLUG);
+    qca7k_mme_put_u8(w, hdr->mmv);
+    qca7k_mme_put_u16(w, hdr->mmtype);
+    if (hdr->mmv != QCA7K_MMV_1_0)
+    {
+        qca7k_mme_put_u8(w, (uint8_t)(hdr->nf_mi << 4 | (hdr->fn_mi & 0x0F)));
+        qca7k_mme_put_u8(w, hdr->fmsn);
+    }
+    if (hdr->mmtype >= QCA7K_MME_VENDOR_FIRST && hdr->mmtype <= QCA7K_MME_VENDOR_LAST)
+        qca7k_mme_put(w, hdr->oui, 3);
+}
+
+qca7k_state_t qca7k_mme_finish(qca7k_mme_writer_t* w, size_t* size)
+{
+    if (w->size < QCA7K_FRAME_MIN)
+        qca7k_mme_put(w, NULL, QCA7K_FRAME_MIN - w->size);
+    if (w->overflow)
+        return QCA7K_FRAME_OVERFLOW;
+
+    if (size)
+        *size = w->size;
+    return QCA7K_OK;
+}
+
+bool qca7k_mme_parse(const uint8_t* data, size_t size, qca7k_mme_t* mme)
+{
+    if (!data || size > QCA7K_FRAME_MAX)
+        return false;
+
+    /* EtherType follows the MACs, possibly behind a VLAN tag */
+    size_t offset = 12;
+    if (size >= 18 && data[12] == (uint8_t)(QCA7K_ETHERTYPE_VLAN >> 8) && data[13] == (uint8_t)QCA7K_ETHERTYPE_VLAN)
+        offset = 16;
+    if (size < offset + 5 || data[offset] != (uint8_t)(QCA7K_ETHERTYPE_HOMEPLUG >> 8) || data[offset + 1] != (uint8_t)QCA7K_ETHERTYPE_HOMEPLUG)
+        return false;
+    offset += 2;
+
+    qca7k_mme_hdr_t* hdr = &mme->hdr;
+    *hdr = (qca7k_mme_hdr_t){ 0 };
+    hdr->dst = data;
+    hdr->src = data + QCA7K_MAC_LEN;
+    hdr->mmv = data[offset];
+    hdr->mmtype = data[offset + 1] | ((uint16_t)data[offset + 2]) << 8;
+    offset += 3;
+
+    if (hdr->mmv != QCA7K_MMV_1_0)
+    {
+        if (size < offset + 2)
+            return false;
+        hdr->nf_mi = data[offset] >> 4;
+        hdr->fn_mi = data[offset] & 0x0F;
+        hdr->fmsn = data[offset + 1];
+        offset += 2;
+    }
+    if (hdr->mmtype >= QCA7K_MME_VENDOR_FIRST && hdr->mmtype <= QCA7K_MME_VENDOR_LAST)
+    {
+        if (size < offset + 3)
+            return false;
+        hdr->oui = data + offset;
+        offset += 3;
+    }
+
+    mme->body = data + offset;
+    mme->body_size = size - offset;
+    return true;
+}
+
+void qca7k_mme_read(qca7k_mme_reader_t* r, const qca7k_mme_t* mme)
+{
+    r->ptr = mme->body;
+    r->left = mme->body_size;
+    r->underflow = false;
+}
+
+const uint8_t* qca7k_mme_get(qca7k_mme_reader_t* r, size_t size)
+{
+    if (r->underflow || size > r->left)
+    {
+        r->underflow = true;
+        return NULL;
+    }
+
+    const uint8_t* res = r->ptr;
+    r->ptr += size;
+    r->left -= size;
+    return res;
+}
+
+uint8_t qca7k_mme_get_u8(qca7k_mme_reader_t* r)
+{
+    const uint8_t* p = qca7k_mme_get(r, 1);
+    return p ? p[0] : 0;
+}
+
+uint16_t qca7k_mme_get_u16(qca7k_mme_reader_t* r)
+{
+    const uint8_t* p = qca7k_mme_get(r, 2);
+    return p ? (uint16_t)(p[0] | ((uint16_t)p[1]) << 8) : 0;
+}
+
+static uint32_t qca7k_mme_get_u32(qca7k_mme_reader_t* r)
+{
+    const uint8_t* p = qca7k_mme_get(r, 4);
+    return p ? p[0] | ((uint32_t)p[1]) << 8 | ((uint32_t)p[2]) << 16 | ((uint32_t)p[3]) << 24 : 0;
+}
+
+/** Start reading the payload if the message type matches */
+static bool qca7k_mme_expect(qca7k_mme_reader_t* r, const qca7k_mme_t* mme, uint16_t mmtype)
+{
+    if (mme->hdr.mmtype != mmtype)
+        return false;
+    qca7k_mme_read(r, mme);
+    return true;
+}
+
+/** Length of the variable field of CM_SLAC_MATCH, from the PEV ID on */
+#define QCA7K_SLAC_MATCH_REQ_MVF (2 * QCA7K_SLAC_ID_LEN + 2 * QCA7K_MAC_LEN + QCA7K_SLAC_RUNID_LEN + 8)
+#define QCA7K_SLAC_MATCH_CNF_MVF (QCA7K_SLAC_MATCH_REQ_MVF + QCA7K_NID_LEN + 1 + QCA7K_NMK_LEN)
+
+/* Encoders, in the field order of ISO 15118-3 */
+void qca7k_mme_put_slac_param_req(qca7k_mme_writer_t* w, const qca7k_slac_param_req_t* m)
+{
+    qca7k_mme_put_u8(w, m->application_type);
+    qca7k_mme_put_u8(w, m->security_type);
+    qca7k_mme_put(w, m->run_id, QCA7K_SLAC_RUNID_LEN);
+}
+
+void qca7k_mme_put_slac_param_cnf(qca7k_mme_writer_t* w, const qca7k_slac_param_cnf_t* m)
+{
+    qca7k_mme_put(w, m->msound_target, QCA7K_MAC_LEN);
+    qca7k_mme_put_u8(w, m->num_sounds);
+    qca7k_mme_put_u8(w, m->time_out);
+    qca7k_mme_put_u8(w, m->resp_type);
+    qca7k_mme_put(w, m->forwarding_sta, QCA7K_MAC_LEN);
+    qca7k_mme_put_u8(w, m->application_type);
+    qca7k_mme_put_u8(w, m->security_type);
+    qca7k_mme_put(w, m->run_id, QCA7K_SLAC_RUNID_LEN);
+}
+
+void qca7k_mme_put_start_atten_char_ind(qca7k_mme_writer_t* w, const qca7k_start_atten_char_ind_t* m)
+{
+    qca7k_mme_put_u8(w, m->application_type);
+    qca7k_mme_put_u8(w, m->security_type);
+    qca7k_mme_put_u8(w, m->num_sounds);
+    qca7k_mme_put_u8(w, m->time_out);
+    qca7k_mme_put_u8(w, m->resp_type);
+    qca7k_mme_put(w, m->forwarding_sta, QCA7K_MAC_LEN);
+    qca7k_mme_put(w, m->run_id, QCA7K_SLAC_RUNID_LEN);
+}
+
+void qca7k_mme_put_mnbc_sound_ind(qca7k_mme_writer_t* w, const qca7k_mnbc_sound_ind_t* m)
+{
+    qca7k_mme_put_u8(w, m->application_type);
+    qca7k_mme_put_u8(w, m->security_type);
+    qca7k_mme_put(w, m->sender_id, QCA7K_SLAC_ID_LEN);
+    qca7k_mme_put_u8(w, m->count);
+    qca7k_mme_put(w, m->run_id, QCA7K_SLAC_RUNID_LEN);
+    qca7k_mme_put(w, NULL, 8);
+    qca7k_mme_put(w, m->rnd, 16);
+}
+
+void qca7k_mme_put_atten_profile_ind(qca7k_mme_writer_t* w, const qca7k_atten_profile_ind_t* m)
+{
+    qca7k_mme_put(w, m->pev_mac, QCA7K_MAC_LEN);
+    qca7k_mme_put_u8(w, m->num_groups);
+    qca7k_mme_put_u8(w, 0);
+    qca7k_mme_put(w, m->aag, m->num_groups);
+}
+
+void qca7k_mme_put_atten_char_ind(qca7k_mme_writer_t* w, const qca7k_atten_char_ind_t* m)
+{
+    qca7k_mme_put_u8(w, m->application_type);
+    qca7k_mme_put_u8(w, m->security_type);
+    qca7k_mme_put(w, m->source_address, QCA7K_MAC_LEN);
+    qca7k_mme_put(w, m->run_id, QCA7K_SLAC_RUNID_LEN);
+    qca7k_mme_put(w, m->source_id, QCA7K_SLAC_ID_LEN);
+    qca7k_mme_put(w, m->resp_id, QCA7K_SLAC_ID_LEN);
+    qca7k_mme_put_u8(w, m->num_sounds);
+    qca7k_mme_put_u8(w, m->num_groups);
+    qca7k_mme_put(w, m->aag, m->num_groups);
+}
+
+void qca7k_mme_put_atten_char_rsp(qca7k_mme_writer_t* w, const qca7k_atten_char_rsp_t* m)
+{
+    qca7k_mme_put_u8(w, m->application_type);
+    qca7k_mme_put_u8(w, m->security_type);
+    qca7k_mme_put(w, m->source_address, QCA7K_MAC_LEN);
+    qca7k_mme_put(w, m->run_id, QCA7K_SLAC_RUNID_LEN);
+    qca7k_mme_put(w, m->source_id, QCA7K_SLAC_ID_LEN);
+    qca7k_mme_put(w, m->resp_id, QCA7K_SLAC_ID_LEN);
+    qca7k_mme_put_u8(w, m->result);
+}
+
+void qca7k_mme_put_validate(qca7k_mme_writer_t* w, const qca7k_validate_t* m)
+{
+    qca7k_mme_put_u8(w, m->signal_type);
+    qca7k_mme_put_u8(w, m->timer_or_toggles);
+    qca7k_mme_put_u8(w, m->result);
+}
+
+void qca7k_mme_put_slac_match(qca7k_mme_writer_t* w, const qca7k_slac_match_t* m, bool cnf)
+{
+    qca7k_mme_put_u8(w, m->application_type);
+    qca7k_mme_put_u8(w, m->security_type);
+    qca7k_mme_put_u16(w, cnf ? QCA7K_SLAC_MATCH_CNF_MVF : QCA7K_SLAC_MATCH_REQ_MVF);
+    qca7k_mme_put(w, m->pev_id, QCA7K_SLAC_ID_LEN);
+    qca7k_mme_put(w, m->pev_mac, QCA7K_MAC_LEN);
+    qca7k_mme_put(w, m->evse_id, QCA7K_SLAC_ID_LEN);
+    qca7k_mme_put(w, m->evse_mac, QCA7K_MAC_LEN);
+    qca7k_mme_put(w, m->run_id, QCA7K_SLAC_RUNID_LEN);
+    qca7k_mme_put(w, NULL, 8);
+    if (!cnf)
+        return;
+    qca7k_mme_put(w, m->nid, QCA7K_NID_LEN);
+    qca7k_mme_put_u8(w, 0);
+    qca7k_mme_put(w, m->nmk, QCA7K_NMK_LEN);
+}
+
+void qca7k_mme_put_set_key_req(qca7k_mme_writer_t* w, const qca7k_set_key_req_t* m)
+{
+    qca7k_mme_put_u8(w, m->key_type);
+    qca7k_mme_put_u32(w, m->my_nonce);
+    qca7k_mme_put_u32(w, m->your_nonce);
+    qca7k_mme_put_u8(w, m->pid);
+    qca7k_mme_put_u16(w, m->prn);
+    qca7k_mme_put_u8(w, m->pmn);
+    qca7k_mme_put_u8(w, m->cco_capability);
+    qca7k_mme_put(w, m->nid, QCA7K_NID_LEN);
+    qca7k_mme_put_u8(w, m->new_eks);
+    qca7k_mme_put(w, m->new_key, QCA7K_NMK_LEN);
+}
+
+void qca7k_mme_put_set_key_cnf(qca7k_mme_writer_t* w, const qca7k_set_key_cnf_t* m)
+{
+    qca7k_mme_put_u8(w, m->result);
+    qca7k_mme_put_u32(w, m->my_nonce);
+    qca7k_mme_put_u32(w, m->your_nonce);
+    qca7k_mme_put_u8(w, m->pid);
+    qca7k_mme_put_u16(w, m->prn);
+    qca7k_mme_put_u8(w, m->pmn);
+    qca7k_mme_put_u8(w, m->cco_capability);
+}
+
+/* Decoders, the mirror images */
+bool qca7k_mme_get_slac_param_req(const qca7k_mme_t* mme, qca7k_slac_param_req_t* m)
+{
+    qca7k_mme_reader_t r;
+    if (!qca7k_mme_expect(&r, mme, QCA7K_MME_CM_SLAC_PARAM | QCA7K_MME_REQ))
+        return false;
+    m->application_type = qca7k_mme_get_u8(&r);
+    m->security_type = qca7k_mme_get_u8(&r);
+    m->run_id = qca7k_mme_get(&r, QCA7K_SLAC_RUNID_LEN);
+    return !r.underflow;
+}
+
+bool qca7k_mme_get_slac_param_cnf(const qca7k_mme_t* mme, qca7k_slac_param_cnf_t* m)
+{
+    qca7k_mme_reader_t r;
+    if (!qca7k_mme_expect(&r, mme, QCA7K_MME_CM_SLAC_PARAM | QCA7K_MME_CNF))
+        return false;
+    m->msound_target = qca7k_mme_get(&r, QCA7K_MAC_LEN);
+    m->num_sounds = qca7k_mme_get_u8(&r);
+    m->time_out = qca7k_mme_get_u8(&r);
+    m->resp_type = qca7k_mme_get_u8(&r);
+    m->forwarding_sta = qca7k_mme_get(&r, QCA7K_MAC_LEN);
+    m->application_type = qca7k_mme_get_u8(&r);
+    m->security_type = qca7k_mme_get_u8(&r);
+    m->run_id = qca7k_mme_get(&r, QCA7K_SLAC_RUNID_LEN);
+    return !r.underflow;
+}
+
+bool qca7k_mme_get_start_atten_char_ind(const qca7k_mme_t* mme, qca7k_start_atten_char_ind_t* m)
+{
+    qca7k_mme_reader_t r;
+    if (!qca7k_mme_expect(&r, mme, QCA7K_MME_CM_START_ATTEN_CHAR | QCA7K_MME_IND))
+        return false;
+    m->application_type = qca7k_mme_get_u8(&r);
+    m->security_type = qca7k_mme_get_u8(&r);
+    m->num_sounds = qca7k_mme_get_u8(&r);
+    m->time_out = qca7k_mme_get_u8(&r);
+    m->resp_type = qca7k_mme_get_u8(&r);
+    m->forwarding_sta = qca7k_mme_get(&r, QCA7K_MAC_LEN);
+    m->run_id = qca7k_mme_get(&r, QCA7K_SLAC_RUNID_LEN);
+    return !r.underflow;
+}
+
+bool qca7k_mme_get_mnbc_sound_ind(const qca7k_mme_t* mme, qca7k_mnbc_sound_ind_t* m)
+{
+    qca7k_mme_reader_t r;
+    if (!qca7k_mme_expect(&r, mme, QCA7K_MME_CM_MNBC_SOUND | QCA7K_MME_IND))
+        return false;
+    m->application_type = qca7k_mme_get_u8(&r);
+    m->security_type = qca7k_mme_get_u8(&r);
+    m->sender_id = qca7k_mme_get(&r, QCA7K_SLAC_ID_LEN);
+    m->count = qca7k_mme_get_u8(&r);
+    m->run_id = qca7k_mme_get(&r, QCA7K_SLAC_RUNID_LEN);
+    (void)qca7k_mme_get(&r, 8);
+    m->rnd = qca7k_mme_get(&r, 16);
+    return !r.underflow;
+}
+
+bool qca7k_mme_get_atten_profile_ind(const qca7k_mme_t* mme, qca7k_atten_profile_ind_t* m)
+{
+    qca7k_mme_reader_t r;
+    if (!qca7k_mme_expect(&r, mme, QCA7K_MME_CM_ATTEN_PROFILE | QCA7K_MME_IND))
+        return false;
+    m->pev_mac = qca7k_mme_get(&r, QCA7K_MAC_LEN);
+    m->num_groups = qca7k_mme_get_u8(&r);
+    (void)qca7k_mme_get_u8(&r);
+    m->aag = qca7k_mme_get(&r, m->num_groups);
+    return !r.underflow;
+}
+
+bool qca7k_mme_get_atten_char_ind(const qca7k_mme_t* mme, qca7k_atten_char_ind_t* m)
+{
+    qca7k_mme_reader_t r;
+    if (!qca7k_mme_expect(&r, mme, QCA7K_MME_CM_ATTEN_CHAR | QCA7K_MME_IND))
+        return false;
+    m->application_type = qca7k_mme_get_u8(&r);
+    m->security_type = qca7k_mme_get_u8(&r);
+    m->source_address = qca7k_mme_get(&r, QCA7K_MAC_LEN);
+    m->run_id = qca7k_mme_get(&r, QCA7K_SLAC_RUNID_LEN);
+    m->source_id = qca7k_mme_get(&r, QCA7K_SLAC_ID_LEN);
+    m->resp_id = qca7k_mme_get(&r, QCA7K_SLAC_ID_LEN);
+    m->num_sounds = qca7k_mme_get_u8(&r);
+    m->num_groups = qca7k_mme_get_u8(&r);
+    m->aag = qca7k_mme_get(&r, m->num_groups);
+    return !r.underflow;
+}
+
+bool qca7k_mme_get_atten_char_rsp(const qca7k_mme_t* mme, qca7k_atten_char_rsp_t* m)
+{
+    qca7k_mme_reader_t r;
+    if (!qca7k_mme_expect(&r, mme, QCA7K_MME_CM_ATTEN_CHAR | QCA7K_MME_RSP))
+        return false;
+    m->application_type = qca7k_mme_get_u8(&r);
+    m->security_type = qca7k_mme_get_u8(&r);
+    m->source_address = qca7k_mme_get(&r, QCA7K_MAC_LEN);
+    m->run_id = qca7k_mme_get(&r, QCA7K_SLAC_RUNID_LEN);
+    m->source_id = qca7k_mme_get(&r, QCA7K_SLAC_ID_LEN);
+    m->resp_id = qca7k_mme_get(&r, QCA7K_SLAC_ID_LEN);
+    m->result = qca7k_mme_get_u8(&r);
+    return !r.underflow;
+}
+
+bool qca7k_mme_get_validate(const qca7k_mme_t* mme, qca7k_validate_t* m)
+{
+    qca7k_mme_reader_t r;
+    if (!qca7k_mme_expect(&r, mme, QCA7K_MME_CM_VALIDATE | QCA7K_MME_REQ)
+        && !qca7k_mme_expect(&r, mme, QCA7K_MME_CM_VALIDATE | QCA7K_MME_CNF))
+        return false;
+    m->signal_type = qca7k_mme_get_u8(&r);
+    m->timer_or_toggles = qca7k_mme_get_u8(&r);
+    m->result = qca7k_mme_get_u8(&r);
+    return !r.underflow;
+}
+
+bool qca7k_mme_get_slac_match(const qca7k_mme_t* mme, qca7k_slac_match_t* m)
+{
+    qca7k_mme_reader_t r;
+    bool cnf = qca7k_mme_expect(&r, mme, QCA7K_MME_CM_SLAC_MATCH | QCA7K_MME_CNF);
+    if (!cnf && !qca7k_mme_expect(&r, mme, QCA7K_MME_CM_SLAC_MATCH | QCA7K_MME_REQ))
+        return false;
+    m->application_type = qca7k_mme_get_u8(&r);
+    m->security_type = qca7k_mme_get_u8(&r);
+    (void)qca7k_mme_get_u16(&r);
+    m->pev_id = qca7k_mme_get(&r, QCA7K_SLAC_ID_LEN);
+    m->pev_mac = qca7k_mme_get(&r, QCA7K_MAC_LEN);
+    m->evse_id = qca7k_mme_get(&r, QCA7K_SLAC_ID_LEN);
+    m->evse_mac = qca7k_mme_get(&r, QCA7K_MAC_LEN);
+    m->run_id = qca7k_mme_get(&r, QCA7K_SLAC_RUNID_LEN);
+    (void)qca7k_mme_get(&r, 8);
+    m->nid = NULL;
+    m->nmk = NULL;
+    if (cnf)
+    {
+        m->nid = qca7k_mme_get(&r, QCA7K_NID_LEN);
+        (void)qca7k_mme_get_u8(&r);
+        m->nmk = qca7k_mme_get(&r, QCA7K_NMK_LEN);
+    }
+    return !r.underflow;
+}
+
+bool qca7k_mme_get_set_key_req(const qca7k_mme_t* mme, qca7k_set_key_req_t* m)
+{
+    qca7k_mme_reader_t r;
+    if (!qca7k_mme_expect(&r, mme, QCA7K_MME_CM_SET_KEY | QCA7K_MME_REQ))
+        return false;
+    m->key_type = qca7k_mme_get_u8(&r);
+    m->my_nonce = qca7k_mme_get_u32(&r);
+    m->your_nonce = qca7k_mme_get_u32(&r);
+    m->pid = qca7k_mme_get_u8(&r);
+    m->prn = qca7k_mme_get_u16(&r);
+    m->pmn = qca7k_mme_get_u8(&r);
+    m->cco_capability = qca7k_mme_get_u8(&r);
+    m->nid = qca7k_mme_get(&r, QCA7K_NID_LEN);
+    m->new_eks = qca7k_mme_get_u8(&r);
+    m->new_key = qca7k_mme_get(&r, QCA7K_NMK_LEN);
+    return !r.underflow;
+}
+
+bool qca7k_mme_get_set_key_cnf(const qca7k_mme_t* mme, qca7k_set_key_cnf_t* m)
+{
+    qca7k_mme_reader_t r;
+    if (!qca7k_mme_expect(&r, mme, QCA7K_MME_CM_SET_KEY | QCA7K_MME_CNF))
+        return false;
+    m->result = qca7k_mme_get_u8(&r);
+    m->my_nonce = qca7k_mme_get_u32(&r);
+    m->your_nonce = qca7k_mme_get_u32(&r);
+    m->pid = qca7k_mme_get_u8(&r);
+    m->prn = qca7k_mme_get_u16(&r);
+    m->pmn = qca7k_mme_get_u8(&r);
+    m->cco_capability = qca7k_mme_get_u8(&r);
+    return !r.underflow;
+}
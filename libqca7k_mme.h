@@ -0,0 +1,345 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+/* HomePlug AV management messages
+ * Encodes MMEs straight into transmit buffers (e.g. the data of a pool frame) and decodes received ones in place:
+ * scalars are read out, everything longer (addresses, run IDs, keys, attenuation groups) is pointed to in the frame.
+ * Multi-byte fields are little endian as in the specification, the EtherType is big endian as usual.
+ * Covers the ISO 15118-3 SLAC messages and CM_SET_KEY, other messages can be put together with the field functions.
+ * NOTE: does not need libqca7k.c
+ */
+
+#ifndef LIBQCA7K_MME_H
+#define LIBQCA7K_MME_H
+
+#include "libqca7k.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** MME version 1.0, no fragmentation information */
+#define QCA7K_MMV_1_0 0x00
+/** MME version 1.1, the one ISO 15118-3 uses */
+#define QCA7K_MMV_1_1 0x01
+
+/** Station address length */
+#define QCA7K_MAC_LEN 6
+/** SLAC run identifier length */
+#define QCA7K_SLAC_RUNID_LEN 8
+/** Station identifier length in the SLAC messages */
+#define QCA7K_SLAC_ID_LEN 17
+/** Network identifier length */
+#define QCA7K_NID_LEN 7
+/** Network membership key length */
+#define QCA7K_NMK_LEN 16
+/** Carrier groups the attenuation profile is given for */
+#define QCA7K_SLAC_GROUPS 58
+
+/* Message types, combine with a subtype */
+typedef enum
+{
+    QCA7K_MME_CM_SET_KEY = 0x6008,
+    QCA7K_MME_CM_AMP_MAP = 0x601C,
+    QCA7K_MME_CM_SLAC_PARAM = 0x6064,
+    QCA7K_MME_CM_START_ATTEN_CHAR = 0x6068,
+    QCA7K_MME_CM_ATTEN_CHAR = 0x606C,
+    QCA7K_MME_CM_PKCS_CERT = 0x6070,
+    QCA7K_MME_CM_MNBC_SOUND = 0x6074,
+    QCA7K_MME_CM_VALIDATE = 0x6078,
+    QCA7K_MME_CM_SLAC_MATCH = 0x607C,
+    QCA7K_MME_CM_SLAC_USER_DATA = 0x6080,
+    QCA7K_MME_CM_ATTEN_PROFILE = 0x6084,
+} qca7k_mmtype_t;
+
+/* Message subtypes, the lower 2 bits of the message type */
+typedef enum
+{
+    QCA7K_MME_REQ = 0,
+    QCA7K_MME_CNF = 1,
+    QCA7K_MME_IND = 2,
+    QCA7K_MME_RSP = 3,
+} qca7k_mme_subtype_t;
+
+/** First and last vendor specific message type, these carry an OUI before the payload */
+#define QCA7K_MME_VENDOR_FIRST 0xA000
+#define QCA7K_MME_VENDOR_LAST 0xBFFF
+
+/* Message header */
+typedef struct
+{
+    /** Destination and source addresses, NULL source for all zeroes (the chip fills it in) */
+    const uint8_t* dst;
+    const uint8_t* src;
+    /** QCA7K_MMV_1_0 or QCA7K_MMV_1_1 */
+    uint8_t mmv;
+    /** Message type with the subtype */
+    uint16_t mmtype;
+    /** Fragmentation (MMV 1.1 only): number of fragments less one, fragment number and sequence number */
+    uint8_t nf_mi;
+    uint8_t fn_mi;
+    uint8_t fmsn;
+    /** Vendor OUI, only for vendor specific message types */
+    const uint8_t* oui;
+} qca7k_mme_hdr_t;
+
+/* Received message, points into the frame */
+typedef struct
+{
+    qca7k_mme_hdr_t hdr;
+    /** Payload after the header (and the OUI), padding included */
+    const uint8_t* body;
+    size_t body_size;
+} qca7k_mme_t;
+
+/* Message being put together, treat as opaque */
+typedef struct
+{
+    uint8_t* buf;
+    /** Room, at most QCA7K_FRAME_MAX */
+    size_t cap;
+    size_t size;
+    bool overflow;
+} qca7k_mme_writer_t;
+
+/* Payload being taken apart, treat as opaque */
+typedef struct
+{
+    const uint8_t* ptr;
+    size_t left;
+    bool underflow;
+} qca7k_mme_reader_t;
+
+/** Start a message: addresses, EtherType, MMV, MMTYPE, fragmentation information and OUI
+ * @param w     writer to set up
+ * @param buf   storage for the frame, e.g. the data of a pool frame
+ * @param cap   size of the storage, anything over QCA7K_FRAME_MAX is not used
+ * @param hdr   header
+ */
+void qca7k_mme_start(qca7k_mme_writer_t* w, uint8_t* buf, size_t cap, const qca7k_mme_hdr_t* hdr);
+
+/** Pad the message to the minimum frame size and get its length
+ * @param w     writer
+ * @param size  pointer to store the frame length, e.g. the size of a pool frame
+ * @return      QCA7K_OK on success, QCA7K_FRAME_OVERFLOW if something did not fit
+ */
+qca7k_state_t qca7k_mme_finish(qca7k_mme_writer_t* w, size_t* size);
+
+/** Put bytes, NULL data for zeroes */
+void qca7k_mme_put(qca7k_mme_writer_t* w, const uint8_t* data, size_t size);
+void qca7k_mme_put_u8(qca7k_mme_writer_t* w, uint8_t v);
+/** Put a 16 bit field, little endian */
+void qca7k_mme_put_u16(qca7k_mme_writer_t* w, uint16_t v);
+
+/** Take a received frame apart
+ * @param data  frame starting with the destination MAC, VLAN tagged or not
+ * @param size  length of data
+ * @param mme   message to fill in, points into data
+ * @return      true if it is a complete HomePlug AV MME header
+ */
+bool qca7k_mme_parse(const uint8_t* data, size_t size, qca7k_mme_t* mme);
+
+/** Start reading the payload of a message */
+void qca7k_mme_read(qca7k_mme_reader_t* r, const qca7k_mme_t* mme);
+
+/** Take bytes
+ * @return      pointer to them in the frame, NULL if there are not enough (the reader is marked then)
+ */
+const uint8_t* qca7k_mme_get(qca7k_mme_reader_t* r, size_t size);
+uint8_t qca7k_mme_get_u8(qca7k_mme_reader_t* r);
+/** Take a 16 bit field, little endian */
+uint16_t qca7k_mme_get_u16(qca7k_mme_reader_t* r);
+
+/* SLAC messages
+ * Fields that are pointers are QCA7K_*_LEN bytes long. To encode, NULL stands for zeroes; after decoding they point
+ * into the frame. The message type is checked by the decoders, they return false if it does not match or the payload
+ * is too short.
+ */
+/* CM_SLAC_PARAM.REQ */
+typedef struct
+{
+    uint8_t application_type;
+    uint8_t security_type;
+    const uint8_t* run_id;
+} qca7k_slac_param_req_t;
+
+/* CM_SLAC_PARAM.CNF */
+typedef struct
+{
+    /** Where the sounds go, broadcast normally */
+    const uint8_t* msound_target;
+    uint8_t num_sounds;
+    /** Sounding time in 100 ms units */
+    uint8_t time_out;
+    uint8_t resp_type;
+    /** EV address */
+    const uint8_t* forwarding_sta;
+    uint8_t application_type;
+    uint8_t security_type;
+    const uint8_t* run_id;
+} qca7k_slac_param_cnf_t;
+
+/* CM_START_ATTEN_CHAR.IND */
+typedef struct
+{
+    uint8_t application_type;
+    uint8_t security_type;
+    uint8_t num_sounds;
+    uint8_t time_out;
+    uint8_t resp_type;
+    const uint8_t* forwarding_sta;
+    const uint8_t* run_id;
+} qca7k_start_atten_char_ind_t;
+
+/* CM_MNBC_SOUND.IND */
+typedef struct
+{
+    uint8_t application_type;
+    uint8_t security_type;
+    const uint8_t* sender_id;
+    /** Sounds still to come */
+    uint8_t count;
+    const uint8_t* run_id;
+    /** 16 random bytes */
+    const uint8_t* rnd;
+} qca7k_mnbc_sound_ind_t;
+
+/* CM_ATTEN_PROFILE.IND, from the local chip for every sound it heard */
+typedef struct
+{
+    const uint8_t* pev_mac;
+    uint8_t num_groups;
+    /** Average attenuation of each group in dB */
+    const uint8_t* aag;
+} qca7k_atten_profile_ind_t;
+
+/* CM_ATTEN_CHAR.IND */
+typedef struct
+{
+    uint8_t application_type;
+    uint8_t security_type;
+    /** EV address */
+    const uint8_t* source_address;
+    const uint8_t* run_id;
+    const uint8_t* source_id;
+    const uint8_t* resp_id;
+    /** Sounds the profile was averaged over */
+    uint8_t num_sounds;
+    uint8_t num_groups;
+    const uint8_t* aag;
+} qca7k_atten_char_ind_t;
+
+/* CM_ATTEN_CHAR.RSP */
+typedef struct
+{
+    uint8_t application_type;
+    uint8_t security_type;
+    const uint8_t* source_address;
+    const uint8_t* run_id;
+    const uint8_t* source_id;
+    const uint8_t* resp_id;
+    uint8_t result;
+} qca7k_atten_char_rsp_t;
+
+/* CM_VALIDATE.REQ and .CNF, the second field is the timer in the request and the toggle count in the confirmation */
+typedef struct
+{
+    uint8_t signal_type;
+    uint8_t timer_or_toggles;
+    uint8_t result;
+} qca7k_validate_t;
+
+/* CM_SLAC_MATCH.REQ and .CNF, the network identifier and key are in the confirmation only */
+typedef struct
+{
+    uint8_t application_type;
+    uint8_t security_type;
+    const uint8_t* pev_id;
+    const uint8_t* pev_mac;
+    const uint8_t* evse_id;
+    const uint8_t* evse_mac;
+    const uint8_t* run_id;
+    const uint8_t* nid;
+    const uint8_t* nmk;
+} qca7k_slac_match_t;
+
+/* CM_SET_KEY.REQ, to put the local chip into the network */
+typedef struct
+{
+    uint8_t key_type;
+    uint32_t my_nonce;
+    uint32_t your_nonce;
+    uint8_t pid;
+    uint16_t prn;
+    uint8_t pmn;
+    uint8_t cco_capability;
+    const uint8_t* nid;
+    uint8_t new_eks;
+    const uint8_t* new_key;
+} qca7k_set_key_req_t;
+
+/* CM_SET_KEY.CNF */
+typedef struct
+{
+    uint8_t result;
+    uint32_t my_nonce;
+    uint32_t your_nonce;
+    uint8_t pid;
+    uint16_t prn;
+    uint8_t pmn;
+    uint8_t cco_capability;
+} qca7k_set_key_cnf_t;
+
+/* Payload encoders, call between qca7k_mme_start with the matching type and qca7k_mme_finish */
+void qca7k_mme_put_slac_param_req(qca7k_mme_writer_t* w, const qca7k_slac_param_req_t* m);
+void qca7k_mme_put_slac_param_cnf(qca7k_mme_writer_t* w, const qca7k_slac_param_cnf_t* m);
+void qca7k_mme_put_start_atten_char_ind(qca7k_mme_writer_t* w, const qca7k_start_atten_char_ind_t* m);
+void qca7k_mme_put_mnbc_sound_ind(qca7k_mme_writer_t* w, const qca7k_mnbc_sound_ind_t* m);
+void qca7k_mme_put_atten_profile_ind(qca7k_mme_writer_t* w, const qca7k_atten_profile_ind_t* m);
+void qca7k_mme_put_atten_char_ind(qca7k_mme_writer_t* w, const qca7k_atten_char_ind_t* m);
+void qca7k_mme_put_atten_char_rsp(qca7k_mme_writer_t* w, const qca7k_atten_char_rsp_t* m);
+void qca7k_mme_put_validate(qca7k_mme_writer_t* w, const qca7k_validate_t* m);
+/** @param cnf  whether it is the confirmation, which also carries the network identifier and key */
+void qca7k_mme_put_slac_match(qca7k_mme_writer_t* w, const qca7k_slac_match_t* m, bool cnf);
+void qca7k_mme_put_set_key_req(qca7k_mme_writer_t* w, const qca7k_set_key_req_t* m);
+void qca7k_mme_put_set_key_cnf(qca7k_mme_writer_t* w, const qca7k_set_key_cnf_t* m);
+
+/* Payload decoders */
+bool qca7k_mme_get_slac_param_req(const qca7k_mme_t* mme, qca7k_slac_param_req_t* m);
+bool qca7k_mme_get_slac_param_cnf(const qca7k_mme_t* mme, qca7k_slac_param_cnf_t* m);
+bool qca7k_mme_get_start_atten_char_ind(const qca7k_mme_t* mme, qca7k_start_atten_char_ind_t* m);
+bool qca7k_mme_get_mnbc_sound_ind(const qca7k_mme_t* mme, qca7k_mnbc_sound_ind_t* m);
+bool qca7k_mme_get_atten_profile_ind(const qca7k_mme_t* mme, qca7k_atten_profile_ind_t* m);
+bool qca7k_mme_get_atten_char_ind(const qca7k_mme_t* mme, qca7k_atten_char_ind_t* m);
+bool qca7k_mme_get_atten_char_rsp(const qca7k_mme_t* mme, qca7k_atten_char_rsp_t* m);
+/** Takes both the request and the confirmation */
+bool qca7k_mme_get_validate(const qca7k_mme_t* mme, qca7k_validate_t* m);
+/** Takes both the request and the confirmation, nid and nmk are NULL for the request */
+bool qca7k_mme_get_slac_match(const qca7k_mme_t* mme, qca7k_slac_match_t* m);
+bool qca7k_mme_get_set_key_req(const qca7k_mme_t* mme, qca7k_set_key_req_t* m);
+bool qca7k_mme_get_set_key_cnf(const qca7k_mme_t* mme, qca7k_set_key_cnf_t* m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
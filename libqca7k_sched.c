@@ -0,0 +1,424 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+#include "libqca7k_sched.h"
+
+#if QCA7K_SCHED_WORKERS > 1 && !defined(QCA7K_THREADS)
+#error "Several scheduler workers need QCA7K_THREADS"
+#endif
+
+/** Words in the bitmap of flagged devices */
+#define QCA7K_SCHED_WORDS ((QCA7K_DEVICES + 31) / 32)
+
+/** Scheduler state of a device */
+struct qca7k_sched_device
+{
+    /** Transmit queue, a ring of frames, guarded by tx_lock */
+    qca7k_frame_t* txq[QCA7K_SCHED_TXQ];
+    size_t tx_head;
+    size_t tx_count;
+    bool tx_lock;
+    /** Set by the interrupt handler, taken by the service */
+    bool irq;
+    /** In a ready queue or being serviced by a worker */
+    bool queued;
+    uint8_t bus;
+    /** The chip has bytes to read, as far as we know */
+    bool rx_ready;
+    /** Bytes the device may still move */
+    size_t deficit;
+    qca7k_sched_stats_t stats;
+};
+
+/** Ready queue of a worker, the worker takes from the bottom, the others steal from the top
+ * Every device is in at most one queue, so it never has more than QCA7K_DEVICES entries
+ */
+struct qca7k_sched_deque
+{
+    long top;
+    long bottom;
+    uint8_t items[QCA7K_DEVICES];
+};
+
+static struct
+{
+    qca7k_sched_handlers_t handlers;
+    struct qca7k_sched_device devs[QCA7K_DEVICES];
+    /** Devices flagged by an interrupt or a transmit and not queued yet, bit per device */
+    uint32_t flagged[QCA7K_SCHED_WORDS];
+    /** Buses taken by a worker */
+    bool bus_busy[QCA7K_SCHED_BUSES];
+    struct qca7k_sched_deque ready[QCA7K_SCHED_WORKERS];
+} _g_sched;
+
+/** Flag a device for the workers to pick up */
+static inline void qca7k_sched_flag(uint8_t dev)
+{
+    __atomic_fetch_or(&_g_sched.flagged[dev / 32], 1u << (dev % 32), __ATOMIC_RELEASE);
+}
+
+void qca7k_sched_init(const qca7k_sched_handlers_t* handlers)
+{
+    for (uint8_t dev = 0; dev < QCA7K_DEVICES; dev++)
+    {
+        struct qca7k_sched_device* d = &_g_sched.devs[dev];
+        for (; d->tx_count; d->tx_count--, d->tx_head = (d->tx_head + 1) % QCA7K_SCHED_TXQ)
+            qca7k_frame_unref(d->txq[d->tx_head]);
+
+        uint8_t bus = d->bus;
+        *d = (struct qca7k_sched_device){ 0 };
+        d->bus = bus;
+        d->irq = true;
+        qca7k_sched_flag(dev);
+    }
+    for (uint8_t w = 0; w < QCA7K_SCHED_WORKERS; w++)
+        _g_sched.ready[w].top = _g_sched.ready[w].bottom = 0;
+
+    _g_sched.handlers = handlers ? *handlers : (qca7k_sched_handlers_t){ 0 };
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+qca7k_state_t qca7k_sched_bus(uint8_t dev, uint8_t bus)
+{
+    if (dev >= QCA7K_DEVICES || bus >= QCA7K_SCHED_BUSES)
+        return QCA7K_NO_DEVICE;
+
+    _g_sched.devs[dev].bus = bus;
+    return QCA7K_OK;
+}
+
+void qca7k_sched_irq(uint8_t dev)
+{
+    if (dev >= QCA7K_DEVICES)
+        return;
+
+    __atomic_store_n(&_g_sched.devs[dev].irq, true, __ATOMIC_RELEASE);
+    qca7k_sched_flag(dev);
+}
+
+static inline void qca7k_sched_tx_lock(struct qca7k_sched_device* d)
+{
+    while (__atomic_test_and_set(&d->tx_lock, __ATOMIC_ACQUIRE))
+        ;
+}
+
+static inline void qca7k_sched_tx_unlock(struct qca7k_sched_device* d)
+{
+    __atomic_clear(&d->tx_lock, __ATOMIC_RELEASE);
+}
+
+qca7k_state_t qca7k_sched_send(uint8_t dev, qca7k_frame_t* frame)
+{
+    if (dev >= QCA7K_DEVICES)
+        return QCA7K_NO_DEVICE;
+    if (!frame)
+        return QCA7K_INVALID_ARGUMENT;
+
+    struct qca7k_sched_device* d = &_g_sched.devs[dev];
+    qca7k_sched_tx_lock(d);
+    bool full = d->tx_count == QCA7K_SCHED_TXQ;
+    if (!full)
+        d->txq[(d->tx_head + d->tx_count++) % QCA7K_SCHED_TXQ] = frame;
+    qca7k_sched_tx_unlock(d);
+
+    if (full)
+        return QCA7K_QUEUE_FULL;
+    qca7k_sched_flag(dev);
+    return QCA7K_OK;
+}
+
+/** Check if the transmit queue has frames */
+static inline bool qca7k_sched_tx_pending(struct qca7k_sched_device* d)
+{
+    return __atomic_load_n(&d->tx_count, __ATOMIC_ACQUIRE) != 0;
+}
+
+/** Transmit queued frames while the deficit covers them
+ * @return  bytes moved
+ */
+static size_t qca7k_sched_transmit(struct qca7k_sched_device* d)
+{
+    size_t moved = 0;
+    for (;;)
+    {
+        /* Only the queue is locked, the bus transfer happens outside */
+        qca7k_sched_tx_lock(d);
+        qca7k_frame_t* frame = d->tx_count ? d->txq[d->tx_head] : NULL;
+        qca7k_sched_tx_unlock(d);
+        if (!frame)
+            break;
+
+        size_t cost = QCA7K_TX_BUFFER_SIZE(frame->size) - 2;
+        if (cost > d->deficit)
+            break;
+
+        /* A chip without space gets its frame next turn, anything else is final */
+        qca7k_state_t res = qca7k_send_frame(frame);
+        if (res == QCA7K_WRITE_BUFFER_INSUFFICIENT)
+            break;
+
+        qca7k_sched_tx_lock(d);
+        d->tx_head = (d->tx_head + 1) % QCA7K_SCHED_TXQ;
+        d->tx_count--;
+        qca7k_sched_tx_unlock(d);
+
+        if (res == QCA7K_OK)
+        {
+            d->deficit -= cost;
+            moved += cost;
+            d->stats.tx_frames++;
+            d->stats.tx_bytes += frame->size;
+        }
+        qca7k_frame_unref(frame);
+    }
+    return moved;
+}
+
+/** Receive frames while the deficit lasts, a frame cut short is resumed next turn
+ * @return  bytes moved
+ */
+static size_t qca7k_sched_receive(uint8_t dev, struct qca7k_sched_device* d)
+{
+    size_t moved = 0;
+    while (d->rx_ready && d->deficit)
+    {
+        qca7k_frame_t* frame;
+        qca7k_budget_t budget = { d->deficit, 0, 0, 0 };
+        qca7k_state_t res = qca7k_recv_frame_budget(&frame, &budget);
+        if (res == QCA7K_POOL_EXHAUSTED)
+            break;
+
+        d->deficit -= budget.spent;
+        moved += budget.spent;
+        if (res == QCA7K_OK)
+        {
+            d->stats.rx_frames++;
+            d->stats.rx_bytes += frame->size;
+            if (_g_sched.handlers.recv)
+                _g_sched.handlers.recv(_g_sched.handlers.ctx, dev, frame);
+            else
+                qca7k_frame_unref(frame);
+        }
+        else
+            d->rx_ready = budget.pending > 0;
+    }
+    return moved;
+}
+
+/** Give a device its turn, the caller has to own it
+ * @return  true if it has work left
+ */
+static bool qca7k_sched_service(uint8_t dev)
+{
+    struct qca7k_sched_device* d = &_g_sched.devs[dev];
+    qca7k_select(dev);
+
+    if (__atomic_exchange_n(&d->irq, false, __ATOMIC_ACQUIRE))
+    {
+        uint16_t reasons = qca7k_interrupt_status(NULL, NULL);
+        if (reasons & QCA7K_INT_PKT_AVLBL)
+            d->rx_ready = true;
+        if ((reasons & ~QCA7K_INT_PKT_AVLBL) && _g_sched.handlers.event)
+            _g_sched.handlers.event(_g_sched.handlers.ctx, dev, reasons & ~QCA7K_INT_PKT_AVLBL);
+        qca7k_interrupts_enable_all();
+    }
+
+    /* An idle device does not save up */
+    if (!d->rx_ready && !qca7k_sched_tx_pending(d))
+    {
+        d->deficit = 0;
+        return false;
+    }
+
+    d->deficit += QCA7K_SCHED_QUANTUM;
+    size_t moved = qca7k_sched_transmit(d);
+    moved += qca7k_sched_receive(dev, d);
+
+    d->stats.turns++;
+    if (moved > d->stats.max_turn)
+        d->stats.max_turn = (uint32_t)moved;
+
+    /* Only what a frame that did not fit needs is carried over, a chip that was not ready does not save up either */
+    bool busy = d->rx_ready || qca7k_sched_tx_pending(d);
+    if (!busy)
+        d->deficit = 0;
+    else if (d->deficit > QCA7K_TX_BUFFER_SIZE(QCA7K_FRAME_MAX))
+        d->deficit = QCA7K_TX_BUFFER_SIZE(QCA7K_FRAME_MAX);
+    return busy;
+}
+
+bool qca7k_sched_run()
+{
+    /* A single thread owns every device, the flags are only there for the workers */
+    for (size_t i = 0; i < QCA7K_SCHED_WORDS; i++)
+        __atomic_store_n(&_g_sched.flagged[i], 0, __ATOMIC_RELAXED);
+
+    bool busy = false;
+    for (uint8_t dev = 0; dev < QCA7K_DEVICES; dev++)
+        busy |= qca7k_sched_service(dev);
+
+    for (uint8_t dev = 0; dev < QCA7K_DEVICES && !busy; dev++)
+        busy = __atomic_load_n(&_g_sched.devs[dev].irq, __ATOMIC_ACQUIRE);
+    return busy;
+}
+
+/** Put a device at the bottom of the own ready queue */
+static void qca7k_deque_push(struct qca7k_sched_deque* q, uint8_t dev)
+{
+    long b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+    __atomic_store_n(&q->items[b % QCA7K_DEVICES], dev, __ATOMIC_RELAXED);
+    __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+/** Take a device from the bottom of the own ready queue
+ * @return  device number, -1 if empty
+ */
+static int qca7k_deque_pop(struct qca7k_sched_deque* q)
+{
+    long b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&q->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&q->top, __ATOMIC_RELAXED);
+
+    if (t > b)
+    {
+        __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    int dev = __atomic_load_n(&q->items[b % QCA7K_DEVICES], __ATOMIC_RELAXED);
+    if (t == b)
+    {
+        /* Last one, a thief may be after it too */
+        if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            dev = -1;
+        __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return dev;
+}
+
+/** Take a device from the top of another worker's ready queue
+ * @return  device number, -1 if empty or lost the race
+ */
+static int qca7k_deque_steal(struct qca7k_sched_deque* q)
+{
+    long t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b)
+        return -1;
+
+    int dev = __atomic_load_n(&q->items[t % QCA7K_DEVICES], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return -1;
+    return dev;
+}
+
+/** Take a flagged device that is not queued anywhere yet
+ * @return  device number, -1 if there is none
+ */
+static int qca7k_sched_claim()
+{
+    for (size_t i = 0; i < QCA7K_SCHED_WORDS; i++)
+    {
+        uint32_t word;
+        while ((word = __atomic_load_n(&_g_sched.flagged[i], __ATOMIC_ACQUIRE)))
+        {
+            uint32_t bit = word & -word;
+            if (!(__atomic_fetch_and(&_g_sched.flagged[i], ~bit, __ATOMIC_ACQ_REL) & bit))
+                continue;
+
+            /* A device already queued or in service is looked at again when its turn ends */
+            int dev = (int)(i * 32 + __builtin_ctz(bit));
+            if (!__atomic_test_and_set(&_g_sched.devs[dev].queued, __ATOMIC_ACQUIRE))
+                return dev;
+        }
+    }
+    return -1;
+}
+
+/** Find a device for the worker, in order of preference
+ * @return  device number, -1 if there is none
+ */
+static int qca7k_sched_next(uint8_t worker)
+{
+    int dev = qca7k_deque_pop(&_g_sched.ready[worker]);
+    if (dev < 0)
+        dev = qca7k_sched_claim();
+    for (uint8_t i = 1; dev < 0 && i < QCA7K_SCHED_WORKERS; i++)
+        dev = qca7k_deque_steal(&_g_sched.ready[(worker + i) % QCA7K_SCHED_WORKERS]);
+    return dev;
+}
+
+/** Hand a device back when its turn ends, requeueing it if it has work or got flagged meanwhile */
+static void qca7k_sched_release(uint8_t worker, uint8_t dev, bool busy)
+{
+    struct qca7k_sched_device* d = &_g_sched.devs[dev];
+    if (busy)
+    {
+        qca7k_deque_push(&_g_sched.ready[worker], dev);
+        return;
+    }
+
+    __atomic_clear(&d->queued, __ATOMIC_RELEASE);
+    bool wanted = __atomic_load_n(&d->irq, __ATOMIC_ACQUIRE) || qca7k_sched_tx_pending(d);
+    if (wanted && !__atomic_test_and_set(&d->queued, __ATOMIC_ACQUIRE))
+        qca7k_deque_push(&_g_sched.ready[worker], dev);
+}
+
+bool qca7k_sched_work(uint8_t worker)
+{
+    if (worker >= QCA7K_SCHED_WORKERS)
+        return false;
+
+    /* Devices on a bus in use are set aside and given back once the worker is done looking */
+    uint8_t skipped[QCA7K_DEVICES];
+    size_t nskipped = 0;
+    bool done = false;
+    int dev;
+    while (!done && (dev = qca7k_sched_next(worker)) >= 0)
+    {
+        struct qca7k_sched_device* d = &_g_sched.devs[dev];
+        if (__atomic_test_and_set(&_g_sched.bus_busy[d->bus], __ATOMIC_ACQUIRE))
+        {
+            skipped[nskipped++] = (uint8_t)dev;
+            continue;
+        }
+
+        bool busy = qca7k_sched_service((uint8_t)dev);
+        __atomic_clear(&_g_sched.bus_busy[d->bus], __ATOMIC_RELEASE);
+        qca7k_sched_release(worker, (uint8_t)dev, busy);
+        done = true;
+    }
+
+    for (size_t i = 0; i < nskipped; i++)
+        qca7k_deque_push(&_g_sched.ready[worker], skipped[i]);
+    /* A skipped device may be the only work left and its interrupts are not flagged while it is queued,
+     * so the caller has to come back for it rather than wait */
+    return done || nskipped;
+}
+
+void qca7k_sched_stats(uint8_t dev, qca7k_sched_stats_t* stats)
+{
+    if (dev < QCA7K_DEVICES && stats)
+        *stats = _g_sched.devs[dev].stats;
+}
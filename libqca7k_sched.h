@@ -0,0 +1,139 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+/* Bus scheduler
+ * Services devices sharing SPI buses. The interrupt handlers only flag their device and the scheduler does all
+ * the bus work, either from a single thread with qca7k_sched_run or from several with qca7k_sched_work.
+ * Bus time is shared by deficit round-robin over bytes: every device with work gets QCA7K_SCHED_QUANTUM bytes
+ * per turn, plus whatever it could not spend last time if its next frame did not fit. With qca7k_sched_run
+ * a device waits at most one round, which is bounded by about QCA7K_DEVICES * (QCA7K_SCHED_QUANTUM + QCA7K_FRAME_MAX)
+ * bytes on the wire.
+ * NOTE: takes over device selection, transmit and receive, do not call those functions aside of it
+ * NOTE: use either qca7k_sched_run or qca7k_sched_work, not both
+ */
+
+#ifndef LIBQCA7K_SCHED_H
+#define LIBQCA7K_SCHED_H
+
+#include "libqca7k.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef QCA7K_SCHED_QUANTUM
+/** Bytes a device with work may move per round, a full frame or more keeps every device moving each round */
+#define QCA7K_SCHED_QUANTUM 1536
+#endif
+
+#ifndef QCA7K_SCHED_TXQ
+/** Frames queued for transmit per device */
+#define QCA7K_SCHED_TXQ 8
+#endif
+
+#ifndef QCA7K_SCHED_WORKERS
+/** Number of worker threads calling qca7k_sched_work, more than one needs QCA7K_THREADS */
+#define QCA7K_SCHED_WORKERS 1
+#endif
+
+#ifndef QCA7K_SCHED_BUSES
+/** Number of SPI buses the devices are spread over */
+#define QCA7K_SCHED_BUSES 1
+#endif
+
+/* Where the scheduler hands things over */
+typedef struct
+{
+    /** Frame received, its reference goes to the handler, release it with qca7k_frame_unref */
+    void (*recv)(void* ctx, uint8_t dev, qca7k_frame_t* frame);
+    /** Interrupt reasons other than QCA7K_INT_PKT_AVLBL, e.g. QCA7K_INT_CPU_ON after a reset (optional) */
+    void (*event)(void* ctx, uint8_t dev, uint16_t reasons);
+    /** Passed to the handlers as is */
+    void* ctx;
+} qca7k_sched_handlers_t;
+
+/* Per device counters */
+typedef struct
+{
+    uint32_t rx_frames;
+    uint32_t tx_frames;
+    uint32_t rx_bytes;
+    uint32_t tx_bytes;
+    /** Rounds the device had work in */
+    uint32_t turns;
+    /** Most bytes moved in a single turn */
+    uint32_t max_turn;
+} qca7k_sched_stats_t;
+
+/** Set up the scheduler, all devices are flagged so whatever they have pending gets picked up
+ * @param handlers  where received frames and events go
+ */
+void qca7k_sched_init(const qca7k_sched_handlers_t* handlers);
+
+/** Put a device on a bus, devices on the same bus are never serviced at the same time
+ * NOTE: all devices are on bus 0 initially, call before the workers start
+ * @param dev   device number
+ * @param bus   bus number, less than QCA7K_SCHED_BUSES
+ * @return      QCA7K_OK on success, QCA7K_NO_DEVICE if there is no such device or bus
+ */
+qca7k_state_t qca7k_sched_bus(uint8_t dev, uint8_t bus);
+
+/** Flag a device as needing service, call from its interrupt handler
+ * @param dev   device number
+ */
+void qca7k_sched_irq(uint8_t dev);
+
+/** Queue a frame for transmit, from any thread
+ * @param dev   device number
+ * @param frame pool frame, its reference goes to the scheduler
+ * @return      QCA7K_OK on success, QCA7K_NO_DEVICE, QCA7K_INVALID_ARGUMENT for no frame or QCA7K_QUEUE_FULL otherwise
+ *              (the caller keeps the reference)
+ */
+qca7k_state_t qca7k_sched_send(uint8_t dev, qca7k_frame_t* frame);
+
+/** Run one round over all devices
+ * @return      true if there is work left, call again right away, otherwise wait for an interrupt
+ */
+bool qca7k_sched_run();
+
+/** Do one turn of work as a worker
+ * Takes a device from the own ready queue, then one flagged by an interrupt or a transmit, then steals one
+ * from the other workers. Devices whose bus is in use by another worker are left for later.
+ * A device left with work goes back to the queue of the worker that serviced it.
+ * NOTE: the threads are up to the application, each one runs a loop for its worker number
+ * @param worker    worker number, less than QCA7K_SCHED_WORKERS
+ * @return          true if a device was serviced or one was left for later because its bus was in use, call again
+ *                  then (yielding in between is fine), otherwise there is nothing to do, wait for an interrupt
+ */
+bool qca7k_sched_work(uint8_t worker);
+
+/** Get the counters of a device
+ * @param dev   device number
+ * @param stats pointer to store the counters
+ */
+void qca7k_sched_stats(uint8_t dev, qca7k_sched_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,731 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+
+
+#include "libqca7k_slac.h"
+#include "libqca7k_atten.h"
+
+#ifdef QCA7K_HAVE_TIME
+
+#include <string.h>
+
+#ifndef QCA7K_SLAC_TT_EVSE_MATCH_SESSION
+/** Time the EVSE waits for CM_SLAC_MATCH.REQ once the results are through, the EV may wait for other EVSEs */
+#define QCA7K_SLAC_TT_EVSE_MATCH_SESSION 10000000
+#endif
+
+/** Sounding time the EVSE announces, in 100 ms units */
+#define QCA7K_SLAC_TIME_OUT (QCA7K_SLAC_TT_EVSE_MATCH_MNBC / 100000)
+
+/** Messages that go out from the poll */
+enum qca7k_slac_out
+{
+    QCA7K_SLAC_OUT_NONE = 0,
+    QCA7K_SLAC_OUT_PARAM_REQ,
+    QCA7K_SLAC_OUT_PARAM_CNF,
+    QCA7K_SLAC_OUT_START_ATTEN_CHAR,
+    QCA7K_SLAC_OUT_SOUND,
+    QCA7K_SLAC_OUT_ATTEN_CHAR_IND,
+    QCA7K_SLAC_OUT_ATTEN_CHAR_RSP,
+    QCA7K_SLAC_OUT_MATCH_REQ,
+    QCA7K_SLAC_OUT_MATCH_CNF,
+    QCA7K_SLAC_OUT_SET_KEY,
+};
+
+/** EVSE as the EV sees it */
+struct qca7k_slac_evse
+{
+    uint8_t mac[QCA7K_MAC_LEN];
+    uint8_t id[QCA7K_SLAC_ID_LEN];
+    uint8_t atten;
+    uint8_t sounds;
+    /** CM_ATTEN_CHAR.IND came in, when it did */
+    bool reported;
+    uint32_t reported_at;
+    /** CM_ATTEN_CHAR.RSP went out */
+    bool answered;
+};
+
+/** Matching state of a device */
+struct qca7k_slac_device
+{
+    qca7k_slac_t slac;
+    qca7k_slac_state_t state;
+    /** Pool frame the messages are put together in */
+    qca7k_frame_t* frame;
+    /** Run identifier, the own one of the EV, the one of the EV on the EVSE */
+    uint8_t run_id[QCA7K_SLAC_RUNID_LEN];
+    /** Station identifier of the other side */
+    uint8_t peer_id[QCA7K_SLAC_ID_LEN];
+    /** Message that goes out next and when */
+    enum qca7k_slac_out out;
+    uint32_t due;
+    /** Whether it answers a message, taken in at the time given */
+    bool answer;
+    uint32_t answering;
+    /** Wait in progress and when it runs out */
+    bool waiting;
+    uint32_t deadline;
+    /** Times the current request went out */
+    uint8_t tries;
+    /** EV: sounding messages sent, EVSE: CM_START_ATTEN_CHAR.IND came in */
+    uint8_t sent;
+    bool started;
+    /** Start of the run and of the current phase */
+    uint32_t run_at;
+    uint32_t phase_at;
+    /** EVSE: attenuation profiles summed up and their average */
+    uint16_t sum[QCA7K_SLAC_GROUPS];
+    uint8_t aag[QCA7K_SLAC_GROUPS];
+    uint8_t groups;
+    /** EV: EVSEs that answered CM_SLAC_PARAM.REQ */
+    struct qca7k_slac_evse evses[QCA7K_SLAC_EVSES];
+    uint8_t evse_count;
+    qca7k_slac_info_t info;
+    qca7k_slac_stats_t stats;
+};
+
+static struct qca7k_slac_device _g_slac[QCA7K_DEVICES];
+
+/** Broadcast address */
+static const uint8_t _g_slac_broadcast[QCA7K_MAC_LEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+/** Address the local chip takes management messages on */
+static const uint8_t _g_slac_local[QCA7K_MAC_LEN] = { 0x00, 0xB0, 0x52, 0x00, 0x00, 0x01 };
+
+static inline struct qca7k_slac_device* qca7k_slac_dev()
+{
+    return &_g_slac[qca7k_selected()];
+}
+
+/** Check if the time has come, wrap around safe */
+static inline bool qca7k_slac_reached(uint32_t now, uint32_t when)
+{
+    return (int32_t)(now - when) >= 0;
+}
+
+static inline void qca7k_slac_wait(struct qca7k_slac_device* d, uint32_t from, uint32_t us)
+{
+    d->waiting = true;
+    d->deadline = from + us;
+}
+
+static inline void qca7k_slac_queue(struct qca7k_slac_device* d, enum qca7k_slac_out out, uint32_t due)
+{
+    d->out = out;
+    d->due = due;
+}
+
+/** Queue the answer to a message taken in at the time given */
+static inline void qca7k_slac_reply(struct qca7k_slac_device* d, enum qca7k_slac_out out, uint32_t at)
+{
+    qca7k_slac_queue(d, out, at);
+    d->answer = true;
+    d->answering = at;
+}
+
+/** Move on to another state, closing the current phase at the time given */
+static void qca7k_slac_enter(struct qca7k_slac_device* d, qca7k_slac_state_t state, uint32_t at)
+{
+    if (d->state >= QCA7K_SLAC_PARAM && d->state < QCA7K_SLAC_MATCHED)
+        d->stats.phase_us[d->state - QCA7K_SLAC_PARAM] = at - d->phase_at;
+    d->phase_at = at;
+    d->state = state;
+    d->info.state = state;
+    d->waiting = false;
+    d->tries = 0;
+
+    if (state == QCA7K_SLAC_MATCHED)
+    {
+        d->stats.total_us = at - d->run_at;
+        d->stats.matched++;
+    }
+    else if (state == QCA7K_SLAC_FAILED)
+    {
+        d->stats.total_us = at - d->run_at;
+        d->stats.failed++;
+        d->out = QCA7K_SLAC_OUT_NONE;
+        qca7k_frame_unref(d->frame);
+        d->frame = NULL;
+    }
+
+    if (d->slac.event)
+        d->slac.event(d->slac.ctx, state);
+}
+
+qca7k_state_t qca7k_slac_start(const qca7k_slac_t* slac)
+{
+    if (!slac)
+        return QCA7K_NULL_RECV_BUFFER;
+
+    struct qca7k_slac_device* d = qca7k_slac_dev();
+    qca7k_frame_t* frame = d->frame ? d->frame : qca7k_frame_alloc();
+    if (!frame)
+        return QCA7K_POOL_EXHAUSTED;
+
+    /* Counters and timing survive runs, the phases are of the last one */
+    qca7k_slac_stats_t stats = d->stats;
+    memset(d, 0, sizeof(*d));
+    d->stats = stats;
+    memset(d->stats.phase_us, 0, sizeof(d->stats.phase_us));
+    d->stats.total_us = 0;
+    d->stats.runs++;
+
+    d->slac = *slac;
+    d->frame = frame;
+    d->run_at = d->phase_at = qca7k_time_us();
+    d->state = d->info.state = QCA7K_SLAC_PARAM;
+    if (slac->role == QCA7K_SLAC_EV)
+    {
+        memcpy(d->run_id, slac->run_id, QCA7K_SLAC_RUNID_LEN);
+        qca7k_slac_queue(d, QCA7K_SLAC_OUT_PARAM_REQ, d->run_at);
+    }
+    else
+    {
+        memcpy(d->info.nid, slac->nid, QCA7K_NID_LEN);
+        memcpy(d->info.nmk, slac->nmk, QCA7K_NMK_LEN);
+        if (slac->init_timeout)
+            qca7k_slac_wait(d, d->run_at, slac->init_timeout);
+    }
+
+    if (slac->event)
+        slac->event(slac->ctx, QCA7K_SLAC_PARAM);
+    return QCA7K_OK;
+}
+
+void qca7k_slac_stop()
+{
+    struct qca7k_slac_device* d = qca7k_slac_dev();
+    qca7k_frame_unref(d->frame);
+    d->frame = NULL;
+    d->state = d->info.state = QCA7K_SLAC_IDLE;
+    d->out = QCA7K_SLAC_OUT_NONE;
+    d->waiting = false;
+}
+
+/** EVSE: the sounds are through, the results go to the EV */
+static void qca7k_slac_sounded(struct qca7k_slac_device* d, uint32_t at)
+{
+    if (!d->info.sounds)
+    {
+        d->stats.timeouts++;
+        qca7k_slac_enter(d, QCA7K_SLAC_FAILED, at);
+        return;
+    }
+
+    qca7k_atten_average(d->aag, d->sum, d->groups, d->info.sounds);
+    d->info.atten = qca7k_atten_mean(d->aag, d->groups);
+    qca7k_slac_enter(d, QCA7K_SLAC_ATTEN, at);
+    qca7k_slac_reply(d, QCA7K_SLAC_OUT_ATTEN_CHAR_IND, at);
+}
+
+/** EVSE side of the state machine */
+static void qca7k_slac_evse_recv(struct qca7k_slac_device* d, const qca7k_mme_t* mme, uint32_t at)
+{
+    const uint8_t* src = mme->hdr.src;
+    bool peer = !memcmp(src, d->info.peer, QCA7K_MAC_LEN);
+
+    union
+    {
+        qca7k_slac_param_req_t param;
+        qca7k_start_atten_char_ind_t start;
+        qca7k_atten_profile_ind_t profile;
+        qca7k_atten_char_rsp_t rsp;
+        qca7k_slac_match_t match;
+        qca7k_set_key_cnf_t key;
+    } m;
+
+    if (qca7k_mme_get_slac_param_req(mme, &m.param))
+    {
+        if (d->state == QCA7K_SLAC_PARAM)
+        {
+            memcpy(d->info.peer, src, QCA7K_MAC_LEN);
+            memcpy(d->run_id, m.param.run_id, QCA7K_SLAC_RUNID_LEN);
+            qca7k_slac_enter(d, QCA7K_SLAC_SOUNDING, at);
+            qca7k_slac_wait(d, at, QCA7K_SLAC_TT_MATCH_SEQUENCE);
+        }
+        else if (d->state != QCA7K_SLAC_SOUNDING || !peer || memcmp(d->run_id, m.param.run_id, QCA7K_SLAC_RUNID_LEN))
+            return;
+        /* The confirmation got lost, it goes again */
+        qca7k_slac_reply(d, QCA7K_SLAC_OUT_PARAM_CNF, at);
+    }
+    else if (qca7k_mme_get_start_atten_char_ind(mme, &m.start))
+    {
+        if (d->state != QCA7K_SLAC_SOUNDING || !peer || d->started || memcmp(d->run_id, m.start.run_id, QCA7K_SLAC_RUNID_LEN))
+            return;
+        d->started = true;
+        qca7k_slac_wait(d, at, QCA7K_SLAC_TT_EVSE_MATCH_MNBC);
+    }
+    else if (qca7k_mme_get_atten_profile_ind(mme, &m.profile))
+    {
+        if (d->state != QCA7K_SLAC_SOUNDING || !d->started || memcmp(m.profile.pev_mac, d->info.peer, QCA7K_MAC_LEN))
+            return;
+        if (!d->info.sounds)
+            d->groups = m.profile.num_groups < QCA7K_SLAC_GROUPS ? m.profile.num_groups : QCA7K_SLAC_GROUPS;
+        /* Right from the frame */
+        qca7k_atten_accumulate(d->sum, m.profile.aag, d->groups < m.profile.num_groups ? d->groups : m.profile.num_groups);
+        if (++d->info.sounds >= QCA7K_SLAC_SOUNDS)
+            qca7k_slac_sounded(d, at);
+    }
+    else if (qca7k_mme_get_atten_char_rsp(mme, &m.rsp))
+    {
+        if (d->state != QCA7K_SLAC_ATTEN || !peer || memcmp(d->run_id, m.rsp.run_id, QCA7K_SLAC_RUNID_LEN))
+            return;
+        qca7k_slac_enter(d, QCA7K_SLAC_MATCH, at);
+        qca7k_slac_wait(d, at, QCA7K_SLAC_TT_EVSE_MATCH_SESSION);
+    }
+    else if (qca7k_mme_get_slac_match(mme, &m.match) && !m.match.nid)
+    {
+        if (d->state < QCA7K_SLAC_ATTEN || d->state == QCA7K_SLAC_FAILED || !peer || memcmp(d->run_id, m.match.run_id, QCA7K_SLAC_RUNID_LEN))
+            return;
+        /* The EV may go on before the response to the results got through */
+        if (d->state == QCA7K_SLAC_ATTEN)
+            qca7k_slac_enter(d, QCA7K_SLAC_MATCH, at);
+        memcpy(d->peer_id, m.match.pev_id, QCA7K_SLAC_ID_LEN);
+        /* Also when the confirmation got lost and the request comes again */
+        qca7k_slac_reply(d, QCA7K_SLAC_OUT_MATCH_CNF, at);
+    }
+    else if (qca7k_mme_get_set_key_cnf(mme, &m.key))
+    {
+        if (d->state == QCA7K_SLAC_KEY)
+            qca7k_slac_enter(d, m.key.result ? QCA7K_SLAC_FAILED : QCA7K_SLAC_MATCHED, at);
+    }
+}
+
+/** EV side of the state machine */
+static void qca7k_slac_ev_recv(struct qca7k_slac_device* d, const qca7k_mme_t* mme, uint32_t at)
+{
+    const uint8_t* src = mme->hdr.src;
+
+    union
+    {
+        qca7k_slac_param_cnf_t param;
+        qca7k_atten_char_ind_t atten;
+        qca7k_slac_match_t match;
+        qca7k_set_key_cnf_t key;
+    } m;
+
+    if (qca7k_mme_get_slac_param_cnf(mme, &m.param))
+    {
+        if (d->state != QCA7K_SLAC_PARAM || memcmp(d->run_id, m.param.run_id, QCA7K_SLAC_RUNID_LEN))
+            return;
+        for (uint8_t i = 0; i < d->evse_count; i++)
+        {
+            if (!memcmp(d->evses[i].mac, src, QCA7K_MAC_LEN))
+                return;
+        }
+        if (d->evse_count < QCA7K_SLAC_EVSES)
+            memcpy(d->evses[d->evse_count++].mac, src, QCA7K_MAC_LEN);
+    }
+    else if (qca7k_mme_get_atten_char_ind(mme, &m.atten))
+    {
+        if ((d->state != QCA7K_SLAC_SOUNDING && d->state != QCA7K_SLAC_ATTEN) || memcmp(d->run_id, m.atten.run_id, QCA7K_SLAC_RUNID_LEN))
+            return;
+        for (uint8_t i = 0; i < d->evse_count; i++)
+        {
+            struct qca7k_slac_evse* evse = &d->evses[i];
+            if (memcmp(evse->mac, src, QCA7K_MAC_LEN))
+                continue;
+            /* Sent again when the response got lost, it goes again */
+            if (!evse->reported)
+            {
+                evse->reported = true;
+                evse->atten = qca7k_atten_mean(m.atten.aag, m.atten.num_groups);
+                evse->sounds = m.atten.num_sounds;
+                memcpy(evse->id, m.atten.resp_id, QCA7K_SLAC_ID_LEN);
+            }
+            evse->reported_at = at;
+            evse->answered = false;
+            break;
+        }
+    }
+    else if (qca7k_mme_get_slac_match(mme, &m.match) && m.match.nid)
+    {
+        if (d->state != QCA7K_SLAC_MATCH || memcmp(d->info.peer, src, QCA7K_MAC_LEN) || memcmp(d->run_id, m.match.run_id, QCA7K_SLAC_RUNID_LEN))
+            return;
+        memcpy(d->info.nid, m.match.nid, QCA7K_NID_LEN);
+        memcpy(d->info.nmk, m.match.nmk, QCA7K_NMK_LEN);
+        qca7k_slac_enter(d, QCA7K_SLAC_KEY, at);
+        qca7k_slac_reply(d, QCA7K_SLAC_OUT_SET_KEY, at);
+    }
+    else if (qca7k_mme_get_set_key_cnf(mme, &m.key))
+    {
+        if (d->state == QCA7K_SLAC_KEY)
+            qca7k_slac_enter(d, m.key.result ? QCA7K_SLAC_FAILED : QCA7K_SLAC_MATCHED, at);
+    }
+}
+
+void qca7k_slac_handler(void* ctx, const uint8_t* data, size_t size)
+{
+    (void)ctx;
+    /* Driver timestamp, the deadlines and the response times run from here */
+    uint32_t at = qca7k_time_us();
+
+    struct qca7k_slac_device* d = qca7k_slac_dev();
+    qca7k_mme_t mme;
+    if (d->state == QCA7K_SLAC_IDLE || d->state == QCA7K_SLAC_FAILED || !qca7k_mme_parse(data, size, &mme))
+        return;
+
+    if (d->slac.role == QCA7K_SLAC_EV)
+        qca7k_slac_ev_recv(d, &mme, at);
+    else
+        qca7k_slac_evse_recv(d, &mme, at);
+}
+
+/** Put a message together in the held frame
+ * @param evse  EVSE the response to the results goes to, NULL for other messages
+ */
+static qca7k_state_t qca7k_slac_compose(struct qca7k_slac_device* d, enum qca7k_slac_out out, const struct qca7k_slac_evse* evse)
+{
+    qca7k_mme_hdr_t hdr = { d->info.peer, d->slac.mac, QCA7K_MMV_1_1, 0, 0, 0, 0, NULL };
+    qca7k_mme_writer_t w;
+    uint8_t count;
+
+    switch (out)
+    {
+        case QCA7K_SLAC_OUT_PARAM_REQ:
+        {
+            qca7k_slac_param_req_t m = { 0, 0, d->run_id };
+            hdr.dst = _g_slac_broadcast;
+            hdr.mmtype = QCA7K_MME_CM_SLAC_PARAM | QCA7K_MME_REQ;
+            qca7k_mme_start(&w, QCA7K_FRAME_DATA(d->frame), QCA7K_FRAME_MAX, &hdr);
+            qca7k_mme_put_slac_param_req(&w, &m);
+            break;
+        }
+
+        case QCA7K_SLAC_OUT_PARAM_CNF:
+        {
+            qca7k_slac_param_cnf_t m = { _g_slac_broadcast, QCA7K_SLAC_SOUNDS, QCA7K_SLAC_TIME_OUT, 1, d->info.peer, 0, 0, d->run_id };
+            hdr.mmtype = QCA7K_MME_CM_SLAC_PARAM | QCA7K_MME_CNF;
+            qca7k_mme_start(&w, QCA7K_FRAME_DATA(d->frame), QCA7K_FRAME_MAX, &hdr);
+            qca7k_mme_put_slac_param_cnf(&w, &m);
+            break;
+        }
+
+        case QCA7K_SLAC_OUT_START_ATTEN_CHAR:
+        {
+            qca7k_start_atten_char_ind_t m = { 0, 0, QCA7K_SLAC_SOUNDS, QCA7K_SLAC_TIME_OUT, 1, d->slac.mac, d->run_id };
+            hdr.dst = _g_slac_broadcast;
+            hdr.mmtype = QCA7K_MME_CM_START_ATTEN_CHAR | QCA7K_MME_IND;
+            qca7k_mme_start(&w, QCA7K_FRAME_DATA(d->frame), QCA7K_FRAME_MAX, &hdr);
+            qca7k_mme_put_start_atten_char_ind(&w, &m);
+            break;
+        }
+
+        case QCA7K_SLAC_OUT_SOUND:
+        {
+            /* Sounds still to come after this one */
+            count = (uint8_t)(QCA7K_SLAC_START_ATTEN_CHAR_INDS + QCA7K_SLAC_SOUNDS - d->sent - 1);
+            qca7k_mnbc_sound_ind_t m = { 0, 0, d->slac.id, count, d->run_id, NULL };
+            hdr.dst = _g_slac_broadcast;
+            hdr.mmtype = QCA7K_MME_CM_MNBC_SOUND | QCA7K_MME_IND;
+            qca7k_mme_start(&w, QCA7K_FRAME_DATA(d->frame), QCA7K_FRAME_MAX, &hdr);
+            qca7k_mme_put_mnbc_sound_ind(&w, &m);
+            break;
+        }
+
+        case QCA7K_SLAC_OUT_ATTEN_CHAR_IND:
+        {
+            qca7k_atten_char_ind_t m = { 0, 0, d->info.peer, d->run_id, NULL, d->slac.id, d->info.sounds, d->groups, d->aag };
+            hdr.mmtype = QCA7K_MME_CM_ATTEN_CHAR | QCA7K_MME_IND;
+            qca7k_mme_start(&w, QCA7K_FRAME_DATA(d->frame), QCA7K_FRAME_MAX, &hdr);
+            qca7k_mme_put_atten_char_ind(&w, &m);
+            break;
+        }
+
+        case QCA7K_SLAC_OUT_MATCH_REQ:
+        {
+            qca7k_slac_match_t m = { 0, 0, d->slac.id, d->slac.mac, d->peer_id, d->info.peer, d->run_id, NULL, NULL };
+            hdr.mmtype = QCA7K_MME_CM_SLAC_MATCH | QCA7K_MME_REQ;
+            qca7k_mme_start(&w, QCA7K_FRAME_DATA(d->frame), QCA7K_FRAME_MAX, &hdr);
+            qca7k_mme_put_slac_match(&w, &m, false);
+            break;
+        }
+
+        case QCA7K_SLAC_OUT_MATCH_CNF:
+        {
+            qca7k_slac_match_t m = { 0, 0, d->peer_id, d->info.peer, d->slac.id, d->slac.mac, d->run_id, d->info.nid, d->info.nmk };
+            hdr.mmtype = QCA7K_MME_CM_SLAC_MATCH | QCA7K_MME_CNF;
+            qca7k_mme_start(&w, QCA7K_FRAME_DATA(d->frame), QCA7K_FRAME_MAX, &hdr);
+            qca7k_mme_put_slac_match(&w, &m, true);
+            break;
+        }
+
+        case QCA7K_SLAC_OUT_SET_KEY:
+        {
+            /* Network membership key into the local chip */
+            qca7k_set_key_req_t m = { 0x01, 0xAAAAAAAA, 0, 0x04, 0, 0, 0, d->info.nid, 0x01, d->info.nmk };
+            hdr.dst = _g_slac_local;
+            hdr.mmtype = QCA7K_MME_CM_SET_KEY | QCA7K_MME_REQ;
+            qca7k_mme_start(&w, QCA7K_FRAME_DATA(d->frame), QCA7K_FRAME_MAX, &hdr);
+            qca7k_mme_put_set_key_req(&w, &m);
+            break;
+        }
+
+        case QCA7K_SLAC_OUT_ATTEN_CHAR_RSP:
+        {
+            /* Goes to the EVSE given, there may be several */
+            qca7k_atten_char_rsp_t m = { 0, 0, d->slac.mac, d->run_id, d->slac.id, evse->id, 0 };
+            hdr.dst = evse->mac;
+            hdr.mmtype = QCA7K_MME_CM_ATTEN_CHAR | QCA7K_MME_RSP;
+            qca7k_mme_start(&w, QCA7K_FRAME_DATA(d->frame), QCA7K_FRAME_MAX, &hdr);
+            qca7k_mme_put_atten_char_rsp(&w, &m);
+            break;
+        }
+
+        default:
+            return QCA7K_INTERNAL_ERROR;
+    }
+
+    qca7k_state_t res = qca7k_mme_finish(&w, &d->frame->size);
+    if (res != QCA7K_OK)
+        return res;
+    return qca7k_send_frame(d->frame);
+}
+
+/** Send a message, keeping track of how late it went out
+ * @param due       when it was due
+ * @param taken     when the message it answers was taken in, 0 if it does not answer one
+ * @param sent      set to the time it went out
+ * @return          true if it went out
+ */
+static bool qca7k_slac_send(struct qca7k_slac_device* d, enum qca7k_slac_out out, const struct qca7k_slac_evse* evse, uint32_t due, bool answer, uint32_t taken, uint32_t* sent)
+{
+    if (qca7k_slac_compose(d, out, evse) != QCA7K_OK)
+    {
+        d->stats.send_errors++;
+        return false;
+    }
+
+    *sent = qca7k_time_us();
+    if (qca7k_slac_reached(*sent, due) && *sent - due > d->stats.max_late_us)
+        d->stats.max_late_us = *sent - due;
+    if (answer && *sent - taken > d->stats.max_response_us)
+        d->stats.max_response_us = *sent - taken;
+    return true;
+}
+
+/** EV: pick the EVSE that measured the least attenuation */
+static void qca7k_slac_choose(struct qca7k_slac_device* d, uint32_t at)
+{
+    const struct qca7k_slac_evse* best = NULL;
+    for (uint8_t i = 0; i < d->evse_count; i++)
+    {
+        if (d->evses[i].reported && (!best || d->evses[i].atten < best->atten))
+            best = &d->evses[i];
+    }
+    if (!best)
+    {
+        d->stats.timeouts++;
+        qca7k_slac_enter(d, QCA7K_SLAC_FAILED, at);
+        return;
+    }
+
+    memcpy(d->info.peer, best->mac, QCA7K_MAC_LEN);
+    memcpy(d->peer_id, best->id, QCA7K_SLAC_ID_LEN);
+    d->info.atten = best->atten;
+    d->info.sounds = best->sounds;
+    qca7k_slac_enter(d, QCA7K_SLAC_MATCH, at);
+    qca7k_slac_queue(d, QCA7K_SLAC_OUT_MATCH_REQ, at);
+}
+
+/** A wait ran out, send the request again or give up */
+static void qca7k_slac_expired(struct qca7k_slac_device* d, uint32_t at)
+{
+    d->waiting = false;
+    switch (d->state)
+    {
+        case QCA7K_SLAC_PARAM:
+            if (d->slac.role == QCA7K_SLAC_EV && d->evse_count)
+            {
+                qca7k_slac_enter(d, QCA7K_SLAC_SOUNDING, at);
+                qca7k_slac_queue(d, QCA7K_SLAC_OUT_START_ATTEN_CHAR, at);
+                return;
+            }
+            break;
+
+        case QCA7K_SLAC_SOUNDING:
+            if (d->slac.role == QCA7K_SLAC_EVSE && d->started)
+            {
+                qca7k_slac_sounded(d, at);
+                return;
+            }
+            break;
+
+        case QCA7K_SLAC_ATTEN:
+            if (d->slac.role == QCA7K_SLAC_EV)
+            {
+                qca7k_slac_choose(d, at);
+                return;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    /* Requests of the EV, the results of the EVSE and the key go again, anything else was up to the other side */
+    bool request = d->state == QCA7K_SLAC_KEY || (d->slac.role == QCA7K_SLAC_EV ? d->state != QCA7K_SLAC_SOUNDING : d->state == QCA7K_SLAC_ATTEN);
+    d->stats.timeouts++;
+    if (!request || d->tries > QCA7K_SLAC_MATCH_RETRY)
+    {
+        qca7k_slac_enter(d, QCA7K_SLAC_FAILED, at);
+        return;
+    }
+
+    static const enum qca7k_slac_out again[] = {
+        [QCA7K_SLAC_PARAM] = QCA7K_SLAC_OUT_PARAM_REQ,
+        [QCA7K_SLAC_ATTEN] = QCA7K_SLAC_OUT_ATTEN_CHAR_IND,
+        [QCA7K_SLAC_MATCH] = QCA7K_SLAC_OUT_MATCH_REQ,
+        [QCA7K_SLAC_KEY] = QCA7K_SLAC_OUT_SET_KEY,
+    };
+    d->stats.retries++;
+    qca7k_slac_queue(d, again[d->state], at);
+}
+
+/** The queued message went out at the time given, see what comes next */
+static void qca7k_slac_sent(struct qca7k_slac_device* d, uint32_t at)
+{
+    enum qca7k_slac_out out = d->out;
+    d->out = QCA7K_SLAC_OUT_NONE;
+    d->answer = false;
+
+    switch (out)
+    {
+        case QCA7K_SLAC_OUT_PARAM_REQ:
+        case QCA7K_SLAC_OUT_ATTEN_CHAR_IND:
+        case QCA7K_SLAC_OUT_MATCH_REQ:
+        case QCA7K_SLAC_OUT_SET_KEY:
+            d->tries++;
+            qca7k_slac_wait(d, at, QCA7K_SLAC_TT_MATCH_RESPONSE);
+            break;
+
+        case QCA7K_SLAC_OUT_START_ATTEN_CHAR:
+        case QCA7K_SLAC_OUT_SOUND:
+            /* The results are waited for from the first message on, the sounds go out in between */
+            if (!d->sent++)
+                qca7k_slac_wait(d, at, QCA7K_SLAC_TT_EV_ATTEN_RESULTS);
+            if (d->sent < QCA7K_SLAC_START_ATTEN_CHAR_INDS + QCA7K_SLAC_SOUNDS)
+            {
+                out = d->sent < QCA7K_SLAC_START_ATTEN_CHAR_INDS ? QCA7K_SLAC_OUT_START_ATTEN_CHAR : QCA7K_SLAC_OUT_SOUND;
+                qca7k_slac_queue(d, out, at + QCA7K_SLAC_TP_EV_BATCH_MSG_INTERVAL);
+            }
+            else
+            {
+                uint32_t deadline = d->deadline;
+                qca7k_slac_enter(d, QCA7K_SLAC_ATTEN, at);
+                qca7k_slac_wait(d, deadline, 0);
+            }
+            break;
+
+        case QCA7K_SLAC_OUT_MATCH_CNF:
+            /* Once, a repeated request only gets the confirmation again */
+            if (d->state == QCA7K_SLAC_MATCH)
+                qca7k_slac_enter(d, QCA7K_SLAC_KEY, at);
+            /* The key goes next, unless it is out already and its confirmation is awaited: the repeated
+             * confirmation may have taken the place of a key that did not go out yet */
+            if (d->state == QCA7K_SLAC_KEY && !d->waiting)
+                qca7k_slac_queue(d, QCA7K_SLAC_OUT_SET_KEY, at);
+            break;
+
+        default:
+            break;
+    }
+}
+
+uint32_t qca7k_slac_poll()
+{
+    struct qca7k_slac_device* d = qca7k_slac_dev();
+    if (d->state == QCA7K_SLAC_IDLE || d->state == QCA7K_SLAC_FAILED)
+        return UINT32_MAX;
+
+    uint32_t now = qca7k_time_us();
+    bool stuck = false;
+
+    /* EV: responses to the results first, the EVSEs are waiting on them */
+    if (d->slac.role == QCA7K_SLAC_EV && d->state <= QCA7K_SLAC_ATTEN)
+    {
+        bool all = d->evse_count;
+        for (uint8_t i = 0; i < d->evse_count; i++)
+        {
+            struct qca7k_slac_evse* evse = &d->evses[i];
+            if (evse->reported && !evse->answered && !stuck)
+                evse->answered = qca7k_slac_send(d, QCA7K_SLAC_OUT_ATTEN_CHAR_RSP, evse, evse->reported_at, true, evse->reported_at, &now);
+            stuck |= evse->reported && !evse->answered;
+            all &= evse->answered;
+        }
+        /* Everyone reported, no need to wait any longer */
+        if (all && d->state == QCA7K_SLAC_ATTEN)
+            qca7k_slac_choose(d, now);
+    }
+
+    /* Messages that are due, as long as they go out */
+    while (!stuck && d->out != QCA7K_SLAC_OUT_NONE && qca7k_slac_reached(now, d->due))
+    {
+        if (!qca7k_slac_send(d, d->out, NULL, d->due, d->answer, d->answering, &now))
+            stuck = true;
+        else
+            qca7k_slac_sent(d, now);
+    }
+
+    if (d->waiting && qca7k_slac_reached(now, d->deadline))
+    {
+        /* The deadline, not the poll, is when it ran out */
+        qca7k_slac_expired(d, d->deadline);
+        if (d->out != QCA7K_SLAC_OUT_NONE && !stuck)
+            return 0;
+    }
+
+    if (d->state == QCA7K_SLAC_FAILED)
+        return UINT32_MAX;
+    if (stuck)
+        return 0;
+
+    uint32_t next = UINT32_MAX;
+    if (d->out != QCA7K_SLAC_OUT_NONE)
+        next = qca7k_slac_reached(now, d->due) ? 0 : d->due - now;
+    if (d->waiting)
+    {
+        uint32_t left = qca7k_slac_reached(now, d->deadline) ? 0 : d->deadline - now;
+        next = left < next ? left : next;
+    }
+    return next;
+}
+
+qca7k_slac_state_t qca7k_slac_state()
+{
+    return qca7k_slac_dev()->state;
+}
+
+void qca7k_slac_info(qca7k_slac_info_t* info)
+{
+    if (info)
+        *info = qca7k_slac_dev()->info;
+}
+
+void qca7k_slac_stats(qca7k_slac_stats_t* stats)
+{
+    if (stats)
+        *stats = qca7k_slac_dev()->stats;
+}
+
+#endif
@@ -0,0 +1,224 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+
+/* SLAC matching (ISO 15118-3)
+ * Event driven state machine for the EVSE and the EV side of the matching over the HomePlug AV link.
+ * Messages are taken in by a receive filter handler, so they are timestamped by the driver as they come off
+ * the bus and every deadline runs from there, not from when the application gets around to it.
+ * What is due goes out from qca7k_slac_poll straight through qca7k_send_frame, ahead of anything the
+ * application queues, from a pool frame each device holds from the start on, so bulk traffic cannot starve it.
+ * A matched EVSE keeps it to answer a repeated CM_SLAC_MATCH.REQ, until qca7k_slac_stop.
+ * The EVSE averages the attenuation profiles its chip reports for the sounds, the EV picks the EVSE that
+ * reports the least attenuation. Both sides put the agreed key into the local chip with CM_SET_KEY.
+ * NOTE: needs QCA7K_HAVE_TIME
+ * NOTE: the handler and qca7k_slac_poll of a device have to be called from the same thread
+ * NOTE: sends with qca7k_send_frame, so not for devices run by the bus scheduler
+ */
+
+#ifndef LIBQCA7K_SLAC_H
+#define LIBQCA7K_SLAC_H
+
+#include "libqca7k_mme.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef QCA7K_HAVE_TIME
+
+/* Timings, in microseconds, and counts, the defaults are the ones of ISO 15118-3 */
+#ifndef QCA7K_SLAC_TT_MATCH_RESPONSE
+/** Time to wait for the answer to a request before sending it again */
+#define QCA7K_SLAC_TT_MATCH_RESPONSE 200000
+#endif
+
+#ifndef QCA7K_SLAC_TT_MATCH_SEQUENCE
+/** Time the EVSE waits for the next message of the EV */
+#define QCA7K_SLAC_TT_MATCH_SEQUENCE 400000
+#endif
+
+#ifndef QCA7K_SLAC_TT_EVSE_MATCH_MNBC
+/** Time the EVSE collects the sounds for, from CM_START_ATTEN_CHAR.IND on */
+#define QCA7K_SLAC_TT_EVSE_MATCH_MNBC 600000
+#endif
+
+#ifndef QCA7K_SLAC_TT_EV_ATTEN_RESULTS
+/** Time the EV waits for the attenuation results, from the first CM_START_ATTEN_CHAR.IND on */
+#define QCA7K_SLAC_TT_EV_ATTEN_RESULTS 1200000
+#endif
+
+#ifndef QCA7K_SLAC_TP_EV_BATCH_MSG_INTERVAL
+/** Time between the sounding messages of the EV */
+#define QCA7K_SLAC_TP_EV_BATCH_MSG_INTERVAL 20000
+#endif
+
+#ifndef QCA7K_SLAC_MATCH_RETRY
+/** Times a request is sent again without an answer */
+#define QCA7K_SLAC_MATCH_RETRY 2
+#endif
+
+#ifndef QCA7K_SLAC_START_ATTEN_CHAR_INDS
+/** CM_START_ATTEN_CHAR.IND the EV sends */
+#define QCA7K_SLAC_START_ATTEN_CHAR_INDS 3
+#endif
+
+#ifndef QCA7K_SLAC_SOUNDS
+/** CM_MNBC_SOUND.IND the EV sends */
+#define QCA7K_SLAC_SOUNDS 10
+#endif
+
+#ifndef QCA7K_SLAC_EVSES
+/** EVSEs the EV keeps track of, the ones answering after that are ignored */
+#define QCA7K_SLAC_EVSES 4
+#endif
+
+/* Side of the link */
+typedef enum
+{
+    QCA7K_SLAC_EVSE = 0,
+    QCA7K_SLAC_EV,
+} qca7k_slac_role_t;
+
+/* Matching states, the ones from QCA7K_SLAC_PARAM to QCA7K_SLAC_KEY are the phases latency is measured for */
+typedef enum
+{
+    /** Not started */
+    QCA7K_SLAC_IDLE = 0,
+    /** EV: waiting for CM_SLAC_PARAM.CNF, EVSE: waiting for CM_SLAC_PARAM.REQ */
+    QCA7K_SLAC_PARAM,
+    /** EV: sending the sounds, EVSE: collecting the attenuation profiles */
+    QCA7K_SLAC_SOUNDING,
+    /** EV: waiting for CM_ATTEN_CHAR.IND, EVSE: waiting for CM_ATTEN_CHAR.RSP */
+    QCA7K_SLAC_ATTEN,
+    /** EV: waiting for CM_SLAC_MATCH.CNF, EVSE: waiting for CM_SLAC_MATCH.REQ */
+    QCA7K_SLAC_MATCH,
+    /** Waiting for CM_SET_KEY.CNF of the local chip */
+    QCA7K_SLAC_KEY,
+    /** Matched, the local chip has the key */
+    QCA7K_SLAC_MATCHED,
+    /** Gave up, see the counters for why */
+    QCA7K_SLAC_FAILED,
+} qca7k_slac_state_t;
+
+/** Number of phases latency is measured for */
+#define QCA7K_SLAC_PHASES (QCA7K_SLAC_MATCHED - QCA7K_SLAC_PARAM)
+
+/* Matching setup */
+typedef struct
+{
+    qca7k_slac_role_t role;
+    /** Host address the messages go out from */
+    uint8_t mac[QCA7K_MAC_LEN];
+    /** Station identifier, PEV ID or EVSE ID */
+    uint8_t id[QCA7K_SLAC_ID_LEN];
+    /** EV: run identifier, pick a random one per run, EVSE: not used */
+    uint8_t run_id[QCA7K_SLAC_RUNID_LEN];
+    /** EVSE: network identifier and key given to the EV, EV: not used */
+    uint8_t nid[QCA7K_NID_LEN];
+    uint8_t nmk[QCA7K_NMK_LEN];
+    /** EVSE: time to wait for CM_SLAC_PARAM.REQ, 0 to wait forever, EV: not used */
+    uint32_t init_timeout;
+    /** Called on every state change (optional) */
+    void (*event)(void* ctx, qca7k_slac_state_t state);
+    /** Passed to the event callback as is */
+    void* ctx;
+} qca7k_slac_t;
+
+/* Outcome of the last run */
+typedef struct
+{
+    qca7k_slac_state_t state;
+    /** Host address of the other side */
+    uint8_t peer[QCA7K_MAC_LEN];
+    /** Network the link was put into, valid once matched */
+    uint8_t nid[QCA7K_NID_LEN];
+    uint8_t nmk[QCA7K_NMK_LEN];
+    /** Average attenuation over the groups in dB, as the EVSE measured it */
+    uint8_t atten;
+    /** Sounds the attenuation was averaged over */
+    uint8_t sounds;
+} qca7k_slac_info_t;
+
+/* Timing of the selected device, from the driver timestamps */
+typedef struct
+{
+    /** Time spent in each phase of the last run, from QCA7K_SLAC_PARAM on */
+    uint32_t phase_us[QCA7K_SLAC_PHASES];
+    /** Time the last run took, start to match or failure */
+    uint32_t total_us;
+    /** Most time from taking in a message to sending the answer, over all runs */
+    uint32_t max_response_us;
+    /** Most time something went out after it was due, over all runs */
+    uint32_t max_late_us;
+    uint32_t runs;
+    uint32_t matched;
+    uint32_t failed;
+    /** Requests sent again without an answer */
+    uint32_t retries;
+    /** Waits that ran out */
+    uint32_t timeouts;
+    /** Frames that could not be sent right away, they are tried again on the next poll */
+    uint32_t send_errors;
+} qca7k_slac_stats_t;
+
+/** Start matching on the selected device, a run in progress is dropped
+ * Put qca7k_slac_handler into the receive filter for QCA7K_ETHERTYPE_HOMEPLUG first, with any OUI
+ * @param slac  setup, copied
+ * @return      QCA7K_OK on success, QCA7K_NULL_RECV_BUFFER for no setup, QCA7K_POOL_EXHAUSTED if the pool has no frame to hold
+ */
+qca7k_state_t qca7k_slac_start(const qca7k_slac_t* slac);
+
+/** Drop the run on the selected device, or let go of a finished one, the pool frame goes back */
+void qca7k_slac_stop();
+
+/** Receive filter handler for HomePlug AV frames, see qca7k_rx_handler_t
+ * Runs the state machine for the selected device, answers go out on the next qca7k_slac_poll
+ */
+void qca7k_slac_handler(void* ctx, const uint8_t* data, size_t size);
+
+/** Send what is due and handle the timeouts of the selected device
+ * Call it after receiving and before sending anything else
+ * @return      microseconds until it has to be called again at the latest, UINT32_MAX if only a frame can move it on
+ */
+uint32_t qca7k_slac_poll();
+
+/** Get the state of the selected device */
+qca7k_slac_state_t qca7k_slac_state();
+
+/** Get the outcome of the last run of the selected device
+ * @param info  pointer to store the outcome
+ */
+void qca7k_slac_info(qca7k_slac_info_t* info);
+
+/** Get the timing and counters of the selected device
+ * @param stats pointer to store them
+ */
+void qca7k_slac_stats(qca7k_slac_stats_t* stats);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
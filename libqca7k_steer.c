@@ -0,0 +1,207 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+
+#include "libqca7k_steer.h"
+
+/** Queue of frames, filled under the lock and emptied by a single consumer without it */
+struct qca7k_steer_queue
+{
+    qca7k_frame_t* frames[QCA7K_STEER_DEPTH];
+    uint8_t devs[QCA7K_STEER_DEPTH];
+    /** Taken so far, written by the consumer only */
+    size_t head;
+    /** Put so far, written under the lock only */
+    size_t tail;
+    bool lock;
+    qca7k_steer_stats_t stats;
+};
+
+static struct
+{
+    qca7k_steer_t steer;
+    struct qca7k_steer_queue queues[QCA7K_STEER_QUEUES];
+} _g_steer;
+
+qca7k_state_t qca7k_steer_init(const qca7k_steer_t* steer)
+{
+    if (!steer)
+        return QCA7K_NULL_RECV_BUFFER;
+    if (steer->fallback >= QCA7K_STEER_QUEUES)
+        return QCA7K_INVALID_ARGUMENT;
+    for (size_t i = 0; i < steer->rule_count; i++)
+    {
+        if (steer->rules[i].queue >= QCA7K_STEER_QUEUES)
+            return QCA7K_INVALID_ARGUMENT;
+    }
+    for (size_t i = 0; i < 8; i++)
+    {
+        if (steer->priority[i] >= QCA7K_STEER_QUEUES)
+            return QCA7K_INVALID_ARGUMENT;
+    }
+    for (size_t i = 0; i < steer->flow_queue_count; i++)
+    {
+        if (steer->flow_queues[i] >= QCA7K_STEER_QUEUES)
+            return QCA7K_INVALID_ARGUMENT;
+    }
+
+    for (uint8_t q = 0; q < QCA7K_STEER_QUEUES; q++)
+    {
+        struct qca7k_steer_queue* queue = &_g_steer.queues[q];
+        for (; queue->head != queue->tail; queue->head++)
+            qca7k_frame_unref(queue->frames[queue->head % QCA7K_STEER_DEPTH]);
+        *queue = (struct qca7k_steer_queue){ 0 };
+    }
+    _g_steer.steer = *steer;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return QCA7K_OK;
+}
+
+/** Hash the IPv6 flow of a frame (FNV-1a)
+ * Extension headers are not followed, a frame with one hashes by the addresses and the next header only
+ * @param data      IPv6 header
+ * @param size      bytes from the IPv6 header on
+ */
+static uint32_t qca7k_steer_hash(const uint8_t* data, size_t size)
+{
+    /* Next header, source and destination addresses */
+    uint32_t hash = 2166136261u;
+    hash = (hash ^ data[6]) * 16777619u;
+    for (size_t i = 8; i < 40; i++)
+        hash = (hash ^ data[i]) * 16777619u;
+
+    /* Source and destination ports of TCP and UDP */
+    if ((data[6] == 6 || data[6] == 17) && size >= 44)
+    {
+        for (size_t i = 40; i < 44; i++)
+            hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+uint8_t qca7k_steer_classify(const uint8_t* data, size_t size)
+{
+    const qca7k_steer_t* steer = &_g_steer.steer;
+    size_t payload;
+    uint16_t type = qca7k_frame_ethertype(data, size, &payload);
+    if (!type)
+        return steer->fallback;
+
+    switch (steer->mode)
+    {
+        case QCA7K_STEER_ETHERTYPE:
+            for (size_t i = 0; i < steer->rule_count; i++)
+            {
+                if (steer->rules[i].ethertype == type)
+                    return steer->rules[i].queue;
+            }
+            break;
+
+        case QCA7K_STEER_VLAN_PRIORITY:
+            /* Priority is in the upper 3 bits of the tag */
+            if (payload == 18)
+                return steer->priority[data[14] >> 5];
+            break;
+
+        case QCA7K_STEER_FLOW_HASH:
+            if (type == QCA7K_ETHERTYPE_IPV6 && steer->flow_queue_count && size >= payload + 40 && (data[payload] >> 4) == 6)
+                return steer->flow_queues[qca7k_steer_hash(data + payload, size - payload) % steer->flow_queue_count];
+            break;
+
+        default:
+            break;
+    }
+    return steer->fallback;
+}
+
+qca7k_state_t qca7k_steer_frame(uint8_t dev, qca7k_frame_t* frame)
+{
+    if (!frame)
+        return QCA7K_NULL_RECV_BUFFER;
+
+    struct qca7k_steer_queue* queue = &_g_steer.queues[qca7k_steer_classify(QCA7K_FRAME_DATA(frame), frame->size)];
+    while (__atomic_test_and_set(&queue->lock, __ATOMIC_ACQUIRE))
+        ;
+
+    size_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    bool full = queue->tail - head == QCA7K_STEER_DEPTH;
+    if (full)
+        queue->stats.dropped++;
+    else
+    {
+        queue->frames[queue->tail % QCA7K_STEER_DEPTH] = frame;
+        queue->devs[queue->tail % QCA7K_STEER_DEPTH] = dev;
+        queue->stats.frames++;
+        __atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_clear(&queue->lock, __ATOMIC_RELEASE);
+
+    if (full)
+    {
+        qca7k_frame_unref(frame);
+        return QCA7K_QUEUE_FULL;
+    }
+    if (_g_steer.steer.notify)
+        _g_steer.steer.notify(_g_steer.steer.ctx, (uint8_t)(queue - _g_steer.queues));
+    return QCA7K_OK;
+}
+
+size_t qca7k_steer_poll()
+{
+    size_t frames = 0;
+    qca7k_frame_t* frame;
+    while (qca7k_recv_frame(&frame) == QCA7K_OK)
+    {
+        (void)qca7k_steer_frame(qca7k_selected(), frame);
+        frames++;
+    }
+    return frames;
+}
+
+qca7k_frame_t* qca7k_steer_pop(uint8_t queue, uint8_t* dev)
+{
+    if (queue >= QCA7K_STEER_QUEUES)
+        return NULL;
+
+    struct qca7k_steer_queue* q = &_g_steer.queues[queue];
+    size_t head = q->head;
+    if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    qca7k_frame_t* frame = q->frames[head % QCA7K_STEER_DEPTH];
+    if (dev)
+        *dev = q->devs[head % QCA7K_STEER_DEPTH];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return frame;
+}
+
+void qca7k_steer_stats(uint8_t queue, qca7k_steer_stats_t* stats)
+{
+    if (queue < QCA7K_STEER_QUEUES && stats)
+    {
+        struct qca7k_steer_queue* q = &_g_steer.queues[queue];
+        while (__atomic_test_and_set(&q->lock, __ATOMIC_ACQUIRE))
+            ;
+        *stats = q->stats;
+        __atomic_clear(&q->lock, __ATOMIC_RELEASE);
+    }
+}
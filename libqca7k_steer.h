@@ -0,0 +1,142 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+/* Receive steering
+ * Sorts received frames into several queues by a classifier, so that every consumer, e.g. a thread on its own
+ * core, takes its frames straight from its queue instead of going through a dispatcher. The classifier looks at
+ * the EtherType, the VLAN priority or a hash of the IPv6 flow, the way RSS spreads flows on a NIC.
+ * Frames come from qca7k_steer_poll, or from qca7k_steer_frame for frames received elsewhere (e.g. the scheduler
+ * receive handler). Any number of threads may put frames in, but every queue has to have a single consumer.
+ * NOTE: a full queue drops the frame, size the pool for QCA7K_STEER_QUEUES * QCA7K_STEER_DEPTH frames if nothing
+ * should be dropped while the consumers keep up
+ */
+
+#ifndef LIBQCA7K_STEER_H
+#define LIBQCA7K_STEER_H
+
+#include "libqca7k.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef QCA7K_STEER_QUEUES
+/** Number of receive queues */
+#define QCA7K_STEER_QUEUES 4
+#endif
+
+#ifndef QCA7K_STEER_DEPTH
+/** Frames each queue holds */
+#define QCA7K_STEER_DEPTH 8
+#endif
+
+/* What the frames are sorted by */
+typedef enum
+{
+    /** EtherType, behind the VLAN tag if there is one */
+    QCA7K_STEER_ETHERTYPE = 0,
+    /** Priority code point of the VLAN tag */
+    QCA7K_STEER_VLAN_PRIORITY,
+    /** Hash of the IPv6 addresses, next header and TCP or UDP ports */
+    QCA7K_STEER_FLOW_HASH,
+} qca7k_steer_mode_t;
+
+/* EtherType to queue mapping */
+typedef struct
+{
+    uint16_t ethertype;
+    uint8_t queue;
+} qca7k_steer_rule_t;
+
+/* Classifier setup */
+typedef struct
+{
+    qca7k_steer_mode_t mode;
+    /** QCA7K_STEER_ETHERTYPE: the first rule with the frame EtherType gives the queue */
+    const qca7k_steer_rule_t* rules;
+    size_t rule_count;
+    /** QCA7K_STEER_VLAN_PRIORITY: queue of each priority */
+    uint8_t priority[8];
+    /** QCA7K_STEER_FLOW_HASH: queues to spread the flows over, picked by the hash modulo the count */
+    const uint8_t* flow_queues;
+    size_t flow_queue_count;
+    /** Queue of the frames the mode has nothing to say about: no rule, no VLAN tag, not IPv6 */
+    uint8_t fallback;
+    /** Queue got a frame, e.g. to wake its consumer up (optional) */
+    void (*notify)(void* ctx, uint8_t queue);
+    /** Passed to notify as is */
+    void* ctx;
+} qca7k_steer_t;
+
+/* Per queue counters */
+typedef struct
+{
+    uint32_t frames;
+    /** Frames dropped as the queue was full */
+    uint32_t dropped;
+} qca7k_steer_stats_t;
+
+/** Set up the classifier and empty the queues
+ * NOTE: call it before any frames come in, the setup is copied, the lists it points to are not
+ * @param steer     setup
+ * @return          QCA7K_OK on success, QCA7K_INVALID_ARGUMENT if a queue number is out of range,
+ *                  QCA7K_NULL_RECV_BUFFER for no setup
+ */
+qca7k_state_t qca7k_steer_init(const qca7k_steer_t* steer);
+
+/** Work out the queue of a frame
+ * @param data      frame starting with the destination MAC
+ * @param size      length of data
+ * @return          queue number
+ */
+uint8_t qca7k_steer_classify(const uint8_t* data, size_t size);
+
+/** Put a frame into its queue
+ * @param dev       device the frame came from, handed to the consumer along with it
+ * @param frame     frame, its reference goes to the queue
+ * @return          QCA7K_OK on success, QCA7K_QUEUE_FULL if the frame was dropped
+ */
+qca7k_state_t qca7k_steer_frame(uint8_t dev, qca7k_frame_t* frame);
+
+/** Receive from the selected device and steer the frames until the read buffer is empty or the pool runs out
+ * @return          number of frames received
+ */
+size_t qca7k_steer_poll();
+
+/** Take the oldest frame of a queue, only one thread may take from a queue
+ * @param queue     queue number
+ * @param dev       pointer to store the device the frame came from, NULL if not needed
+ * @return          frame with its reference going to the caller, NULL if the queue is empty
+ */
+qca7k_frame_t* qca7k_steer_pop(uint8_t queue, uint8_t* dev);
+
+/** Get the counters of a queue
+ * @param queue     queue number
+ * @param stats     pointer to store the counters
+ */
+void qca7k_steer_stats(uint8_t queue, qca7k_steer_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
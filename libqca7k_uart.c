@@ -0,0 +1,75 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+#include "libqca7k_uart.h"
+
+/** Receive state */
+static qca7k_decoder_t _g_uart_dec = QCA7K_DECODER_INIT(NULL);
+
+void qca7k_uart_init(const qca7k_stream_t* stream)
+{
+    qca7k_decoder_init(&_g_uart_dec, stream);
+}
+
+qca7k_state_t qca7k_uart_send(const uint8_t* data, size_t size)
+{
+    if (!data)
+        return QCA7K_NULL_RECV_BUFFER;
+    if (size > QCA7K_FRAME_MAX)
+        return QCA7K_FRAME_OVERFLOW;
+
+    uint8_t header[8];
+    qca7k_encode_header(header, size);
+    qca7k_uart_write(header, sizeof(header));
+
+    qca7k_uart_write(data, size);
+
+    uint8_t trailer[QCA7K_FRAME_MIN_SIZE + 2];
+    qca7k_uart_write(trailer, qca7k_encode_trailer(trailer, size));
+
+    return QCA7K_OK;
+}
+
+size_t qca7k_uart_feed(const uint8_t* data, size_t size)
+{
+    if (!data || !_g_uart_dec.stream)
+        return 0;
+    return qca7k_decoder_feed_all(&_g_uart_dec, data, size);
+}
+
+size_t qca7k_uart_poll()
+{
+    if (!_g_uart_dec.stream)
+        return 0;
+
+    uint8_t chunk[QCA7K_UART_CHUNK];
+    size_t frames = 0, n;
+    while ((n = qca7k_uart_read(chunk, sizeof(chunk))))
+        frames += qca7k_decoder_feed_all(&_g_uart_dec, chunk, n);
+    return frames;
+}
+
+void qca7k_uart_stats(qca7k_rx_stats_t* stats)
+{
+    if (stats)
+        *stats = _g_uart_dec.stats;
+}
@@ -0,0 +1,86 @@
+/*
+* Copyright 2021 Ecognize.me OÜ
+*
+* Licensed under the EUPL, Version 1.2 or – as soon they
+* will be approved by the European Commission - subsequent
+* versions of the EUPL (the "Licence");
+* You may not use this work except in compliance with the
+* Licence.
+* You may obtain a copy of the Licence at:
+*
+* https://joinup.ec.europa.eu/software/page/eupl
+*
+* Unless required by applicable law or agreed to in
+* writing, software distributed under the Licence is
+* distributed on an "AS IS" basis,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied.
+* See the Licence for the specific language governing
+* permissions and limitations under the Licence.
+*/
+
+
+/* UART host interface
+ * The QCA7000 can be strapped for UART instead of SPI. Frames are framed the same way, but there are no registers:
+ * frames are written as they are and the chip sends a plain stream of frames back
+ * NOTE: does not need libqca7k.c, only libqca7k_frame.c
+ */
+
+#ifndef LIBQCA7K_UART_H
+#define LIBQCA7K_UART_H
+
+#include "libqca7k_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef QCA7K_UART_CHUNK
+/** Bytes qca7k_uart_poll reads at once, taken from the stack */
+#define QCA7K_UART_CHUNK 64
+#endif
+
+/** Set where received frames go, resets the receive state
+ * @param stream    callbacks, chunk is mandatory
+ */
+void qca7k_uart_init(const qca7k_stream_t* stream);
+
+/** Send a frame, padded to the minimum size
+ * The header and the trailer go in separate writes around the data, the frame is not copied
+ * @param data  data to transmit
+ * @param size  length of data
+ * @return      QCA7K_OK on success, error code otherwise
+ */
+qca7k_state_t qca7k_uart_send(const uint8_t* data, size_t size);
+
+/** Parse received bytes, e.g. a DMA block or whatever the interrupt handler collected
+ * @param data  bytes as they came in
+ * @param size  number of bytes
+ * @return      number of frames completed
+ */
+size_t qca7k_uart_feed(const uint8_t* data, size_t size);
+
+/** Read everything the UART has through qca7k_uart_read and parse it
+ * @return  number of frames completed
+ */
+size_t qca7k_uart_poll();
+
+/** Get the receive error counters
+ * @param stats pointer to store the counters
+ */
+void qca7k_uart_stats(qca7k_rx_stats_t* stats);
+
+/* Shims the user is expected to provide */
+/** Write bytes to the UART, may block until they are queued */
+void qca7k_uart_write(const uint8_t* data, size_t size);
+
+/** Read bytes the UART has received without blocking
+ * @return  number of bytes read, 0 if there are none
+ */
+size_t qca7k_uart_read(uint8_t* data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif